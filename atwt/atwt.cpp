@@ -1,11 +1,38 @@
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cmath>
 #include <concepts>
+#include <condition_variable>
 #include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <limits>
 #include <memory>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ATWT_STREAM_STORES 1
+#include <emmintrin.h>
+#endif
+
+#if defined(_WIN32)
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <sys/sysctl.h>
+#endif
+
 #include "VSHelper4.h"
 #include "VapourSynth4.h"
 
@@ -20,7 +47,7 @@ constexpr float get_neutral(const VSVideoFormat* fi) noexcept {
     if constexpr (std::floating_point<T>) {
         return 0.0F;
     } else {
-        return static_cast<float>(1 << (fi->bitsPerSample - 1));
+        return static_cast<float>(1LL << (fi->bitsPerSample - 1));
     }
 }
 
@@ -33,146 +60,4028 @@ constexpr float get_max(const VSVideoFormat* fi) noexcept {
     }
 }
 
+#ifdef ATWT_STREAM_STORES
+std::size_t detect_llc_size() {
+    std::size_t llc = 0;
+#if defined(_WIN32)
+    DWORD len = 0;
+    GetLogicalProcessorInformation(nullptr, &len);
+    std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> info(
+        len / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+    if (!info.empty() && GetLogicalProcessorInformation(info.data(), &len)) {
+        for (const auto& i : info) {
+            if (i.Relationship == RelationCache) {
+                llc = std::max<std::size_t>(llc, i.Cache.Size);
+            }
+        }
+    }
+#elif defined(__APPLE__)
+    for (const char* name : {"hw.l3cachesize", "hw.l2cachesize"}) {
+        int64_t size = 0;
+        std::size_t len = sizeof(size);
+        if (sysctlbyname(name, &size, &len, nullptr, 0) == 0 && size > 0) {
+            llc = static_cast<std::size_t>(size);
+            break;
+        }
+    }
+#elif defined(__linux__)
+    for (int index = 0; index < 8; ++index) {
+        std::ifstream file("/sys/devices/system/cpu/cpu0/cache/index" +
+                           std::to_string(index) + "/size");
+        std::size_t size = 0;
+        char unit = 0;
+        if (!(file >> size)) {
+            continue;
+        }
+        file >> unit;
+        if (unit == 'K') {
+            size <<= 10;
+        } else if (unit == 'M') {
+            size <<= 20;
+        }
+        llc = std::max(llc, size);
+    }
+#endif
+    return llc != 0 ? llc : std::size_t{8} << 20;
+}
+
+// Planes whose output is larger than this many bytes are written with
+// non-temporal stores: the last-level cache size, detected on first use.
+std::size_t stream_threshold() {
+    static const std::size_t threshold = detect_llc_size();
+    return threshold;
+}
+#endif
+
+// Copies a finished row to the frame with streaming stores, so outputs that
+// this node never reads back do not evict the rows it is still working on.
+void stream_row(void* VS_RESTRICT dst, const void* VS_RESTRICT src,
+                std::size_t bytes) noexcept {
+#ifdef ATWT_STREAM_STORES
+    auto* d = static_cast<uint8_t*>(dst);
+    const auto* s = static_cast<const uint8_t*>(src);
+    const std::size_t head = std::min<std::size_t>(
+        bytes, (16 - (reinterpret_cast<uintptr_t>(d) & 15)) & 15);
+    std::memcpy(d, s, head);
+    d += head;
+    s += head;
+    bytes -= head;
+    for (; bytes >= 16; bytes -= 16, d += 16, s += 16) {
+        _mm_stream_si128(reinterpret_cast<__m128i*>(d),
+                         _mm_loadu_si128(reinterpret_cast<const __m128i*>(s)));
+    }
+    std::memcpy(d, s, bytes);
+#else
+    std::memcpy(dst, src, bytes);
+#endif
+}
+
+// Streaming stores are weakly ordered; publish them before the frame is
+// handed back to the core.
+void stream_fence() noexcept {
+#ifdef ATWT_STREAM_STORES
+    _mm_sfence();
+#endif
+}
+
+// Hints that bytes of each of rows rows will be read soon, one cache line
+// at a time.
+void prefetch_rows(const void* ptr, ptrdiff_t stride, int rows,
+                   std::size_t bytes) noexcept {
+    const auto* p = static_cast<const uint8_t*>(ptr);
+    for (int y = 0; y < rows; ++y, p += stride) {
+        for (std::size_t offset = 0; offset < bytes; offset += 64) {
+#if defined(__GNUC__) || defined(__clang__)
+            __builtin_prefetch(p + offset);
+#elif defined(ATWT_STREAM_STORES)
+            _mm_prefetch(reinterpret_cast<const char*>(p + offset),
+                         _MM_HINT_T0);
+#endif
+        }
+    }
+}
+
+// Without SSE2 stream_row is a plain copy out of scratch, so every target
+// lacking it keeps writing rows in place.
+template <typename T>
+bool use_stream_stores([[maybe_unused]] int width,
+                       [[maybe_unused]] int height) noexcept {
+#ifdef ATWT_STREAM_STORES
+    return static_cast<std::size_t>(width) * height * sizeof(T) >
+           stream_threshold();
+#else
+    return false;
+#endif
+}
+
+// Detail bit depth of lossless mode, wide enough to hold src - round(blur)
+// for every supported integer input without clamping.
+constexpr int lossless_detail_bits(int bits) noexcept {
+    return bits < 16 ? 16 : 32;
+}
+
+bool is_supported_format(const VSVideoFormat& format) noexcept {
+    return (format.sampleType == stInteger && format.bitsPerSample >= 8 &&
+            format.bitsPerSample <= 16) ||
+           (format.sampleType == stFloat && format.bitsPerSample == 32);
+}
+
+// Signed value of a detail sample. The wrap-around subtraction keeps 32-bit
+// lossless details exact, which a float neutral could not.
+template <typename D>
+float centered(D value, D neutral) noexcept {
+    if constexpr (std::integral<D>) {
+        return static_cast<float>(static_cast<int32_t>(value - neutral));
+    } else {
+        return value - neutral;
+    }
+}
+
 // 101 reflection
 constexpr int mirror_boundary(int pos, int max_pos) noexcept {
     if (pos < 0) {
         return -pos;
     }
-    if (pos >= max_pos) {
-        return (2 * max_pos) - 2 - pos;
+    if (pos >= max_pos) {
+        return (2 * max_pos) - 2 - pos;
+    }
+    return pos;
+}
+
+// The taps of `levels` levels reach 2 * 2^(levels - 1) samples out, which a
+// single reflection only folds back into a plane longer than that. Zero
+// levels leave the axis alone.
+constexpr bool levels_fit(int levels, int size) noexcept {
+    return levels < 1 || (levels < 31 && (1 << levels) < size);
+}
+
+// Whether every plane of vi is large enough for its horizontal and vertical
+// level counts.
+bool levels_fit(const VSVideoInfo& vi, const std::array<int, 3>& levels_h,
+                const std::array<int, 3>& levels_v) noexcept {
+    for (int plane = 0; plane < vi.format.numPlanes; ++plane) {
+        const int ssw = plane != 0 ? vi.format.subSamplingW : 0;
+        const int ssh = plane != 0 ? vi.format.subSamplingH : 0;
+        if (!levels_fit(levels_h[plane], vi.width >> ssw) ||
+            !levels_fit(levels_v[plane], vi.height >> ssh)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool levels_fit(const VSVideoInfo& vi, int levels) noexcept {
+    const std::array<int, 3> all = {levels, levels, levels};
+    return levels_fit(vi, all, all);
+}
+
+// Blurs columns [x_begin, x_end) of each row into dst, which has a row
+// stride of x_end - x_begin. Taps outside the window still read the source,
+// so a window gives the same values as the full row.
+template <typename T>
+void conv_h(const T* VS_RESTRICT src, float* VS_RESTRICT dst, int width,
+            int height, ptrdiff_t src_stride, int step, int x_begin,
+            int x_end) {
+    const int dst_width = x_end - x_begin;
+
+    // Only the outer 2*step columns need reflection; the interior loop
+    // has fixed offsets and vectorizes.
+    const int border = std::clamp(2 * step, x_begin, x_end);
+    const int interior_end = std::clamp(width - (2 * step), border, x_end);
+
+    for (int y = 0; y < height; ++y) {
+        const T* VS_RESTRICT src_row = src + (y * src_stride);
+        float* VS_RESTRICT dst_row = dst + (y * dst_width);
+
+        auto mirrored = [&](int x) {
+            float sum = 0.0F;
+            for (int k = -2; k <= 2; ++k) {
+                int offset_idx = mirror_boundary(x + (k * step), width);
+                sum +=
+                    static_cast<float>(src_row[offset_idx]) * KERNEL.at(k + 2);
+            }
+            dst_row[x - x_begin] = sum;
+        };
+
+        for (int x = x_begin; x < border; ++x) {
+            mirrored(x);
+        }
+        for (int x = border; x < interior_end; ++x) {
+            dst_row[x - x_begin] =
+                (static_cast<float>(src_row[x - (2 * step)]) +
+                 static_cast<float>(src_row[x + (2 * step)])) +
+                (4.0F * (static_cast<float>(src_row[x - step]) +
+                         static_cast<float>(src_row[x + step]))) +
+                (6.0F * static_cast<float>(src_row[x]));
+        }
+        for (int x = interior_end; x < x_end; ++x) {
+            mirrored(x);
+        }
+    }
+}
+
+// Output rows the vertical pass produces per iteration. Rows y, y + step,
+// ... share all but four of their taps, so a block of B rows loads B + 4 tap
+// rows instead of 5 * B. The block is sized so that the taps stay in vector
+// registers: 8 with 32 registers (AVX-512, AArch64), otherwise 4 for float
+// taps and 2 for integer taps, which take several registers each once
+// widened to float.
+constexpr int VERTICAL_MAX_BLOCK_ROWS = 8;
+
+template <typename S>
+constexpr int vertical_block_rows() noexcept {
+#if defined(__AVX512F__) || defined(__aarch64__) || defined(_M_ARM64)
+    return 8;
+#else
+    return std::is_same_v<S, float> ? 4 : 2;
+#endif
+}
+
+// Turns one row of vertical blur sums into detail samples.
+template <typename T, typename D, bool Lossless>
+void store_detail(const T* VS_RESTRICT src_row, D* VS_RESTRICT dst_row,
+                  const float* VS_RESTRICT sums, int width, float kernel_sum,
+                  float neutral, float max_val) {
+    const auto lossless_neutral = static_cast<int64_t>(neutral);
+
+    for (int x = 0; x < width; ++x) {
+        float blurred_pixel = sums[x] / kernel_sum;
+        auto original_pixel = static_cast<float>(src_row[x]);
+
+        float detail = original_pixel - blurred_pixel + neutral;
+
+        if constexpr (std::integral<D>) {
+            if constexpr (Lossless) {
+                // Round the blur instead of the detail, so that the base
+                // round(blur) plus this detail is the source again.
+                dst_row[x] = static_cast<D>(
+                    static_cast<int64_t>(src_row[x]) -
+                    static_cast<int64_t>(std::round(blurred_pixel)) +
+                    lossless_neutral);
+            } else {
+                dst_row[x] = static_cast<D>(
+                    std::clamp(std::round(detail), 0.0F, max_val));
+            }
+        } else {
+            dst_row[x] = detail;
+        }
+    }
+}
+
+// taps holds the rows the vertical pass reads, starting at plane row
+// tap_top: horizontally blurred floats, or the source itself when the
+// horizontal axis is skipped. Without Vertical only the centre row is used.
+// kernel_sum is the total weight of the applied passes. Output rows
+// [y_begin, y_end) are produced in the detail format dfi. stream_buf, if
+// set, holds VERTICAL_MAX_BLOCK_ROWS rows of width.
+template <typename T, typename D, typename S, bool Vertical, bool Lossless>
+void conv_v_and_extract(const S* VS_RESTRICT taps, ptrdiff_t tap_stride,
+                        int tap_top, const T* VS_RESTRICT orig_src,
+                        D* VS_RESTRICT dst, int width, int height, int y_begin,
+                        int y_end, ptrdiff_t src_stride, ptrdiff_t dst_stride,
+                        int step, float kernel_sum, const VSVideoFormat* dfi,
+                        D* VS_RESTRICT stream_buf) {
+    constexpr int BLOCK = Vertical ? vertical_block_rows<S>() : 1;
+
+    const float neutral = get_neutral<D>(dfi);
+    const float max_val = get_max<D>(dfi);
+
+    static_assert(BLOCK <= VERTICAL_MAX_BLOCK_ROWS);
+
+    auto tap_row = [&](int y) -> const S* {
+        return taps + ((mirror_boundary(y, height) - tap_top) * tap_stride);
+    };
+
+    // Produces rows y0, y0 + step, ..., y0 + (rows - 1) * step. The sums of
+    // a chunk of columns go to a local buffer, which cannot alias the rows,
+    // and are turned into details from there.
+    auto block = [&](int y0, auto rows) {
+        constexpr int ROWS = decltype(rows)::value;
+        constexpr int CHUNK = 256;
+        std::array<const S*, ROWS + 4> t{};
+        for (int i = 0; i < ROWS + 4; ++i) {
+            t[i] = Vertical ? tap_row(y0 + ((i - 2) * step))
+                            : taps + ((y0 - tap_top) * tap_stride);
+        }
+        alignas(64) float sums[ROWS][CHUNK];
+
+        for (int x0 = 0; x0 < width; x0 += CHUNK) {
+            const int n = std::min(CHUNK, width - x0);
+            for (int x = 0; x < n; ++x) {
+                if constexpr (Vertical) {
+                    std::array<float, ROWS + 4> v{};
+                    for (int i = 0; i < ROWS + 4; ++i) {
+                        v[i] = static_cast<float>(t[i][x0 + x]);
+                    }
+                    for (int j = 0; j < ROWS; ++j) {
+                        sums[j][x] = (v[j] + v[j + 4]) +
+                                     (4.0F * (v[j + 1] + v[j + 3])) +
+                                     (6.0F * v[j + 2]);
+                    }
+                } else {
+                    sums[0][x] = static_cast<float>(t[2][x0 + x]) * 16.0F;
+                }
+            }
+
+            for (int j = 0; j < ROWS; ++j) {
+                const int y = y0 + (j * step);
+                D* dst_row = stream_buf != nullptr ? stream_buf + (j * width)
+                                                   : dst + (y * dst_stride);
+                store_detail<T, D, Lossless>(
+                    orig_src + (y * src_stride) + x0, dst_row + x0,
+                    std::data(sums[j]), n, kernel_sum, neutral, max_val);
+            }
+        }
+
+        for (int j = 0; stream_buf != nullptr && j < ROWS; ++j) {
+            stream_row(dst + ((y0 + (j * step)) * dst_stride),
+                       stream_buf + (j * width), width * sizeof(D));
+        }
+    };
+
+    // Rows are blocked in runs of BLOCK * step: each of the step phases of
+    // a run forms one block. The tail is done a row at a time.
+    int y = y_begin;
+    if constexpr (BLOCK > 1) {
+        for (; y + (BLOCK * step) <= y_end; y += BLOCK * step) {
+            for (int phase = 0; phase < step; ++phase) {
+                block(y + phase, std::integral_constant<int, BLOCK>{});
+            }
+        }
+    }
+    for (; y < y_end; ++y) {
+        block(y, std::integral_constant<int, 1>{});
+    }
+
+    if (stream_buf != nullptr) {
+        stream_fence();
+    }
+}
+
+// Writes rows [y_begin, y_end) of a band divided by its local RMS,
+// estimated by blurring the squared band with the same dilated B3 kernel.
+// band and energy hold the band and its square from row band_top on, with a
+// 2*step halo around [y_begin, y_end) clipped to the plane; temp is scratch
+// of the same size. Rows are width columns wide, starting at the column dst
+// points to, and only columns [x_begin, x_end) are written; the rest of the
+// window is the 2*step_h halo of the energy blur. The gain maps a local RMS
+// to 1/8 of the sample range and is capped at max_gain.
+template <typename T>
+void normalize_band(const float* VS_RESTRICT band, float* VS_RESTRICT energy,
+                    float* VS_RESTRICT temp, int band_top, int band_bottom,
+                    T* VS_RESTRICT dst, int width, int height, int x_begin,
+                    int x_end, int y_begin, int y_end, ptrdiff_t dst_stride,
+                    int step_h, int step, float eps, float max_gain,
+                    const VSVideoFormat* fi, T* VS_RESTRICT stream_buf) {
+    const float neutral = get_neutral<T>(fi);
+    const float max_val = get_max<T>(fi);
+    const float unit = max_val / 8.0F;
+    const float eps_val = eps * max_val;
+
+    conv_h<float>(energy, temp, width, band_bottom - band_top, width, step_h,
+                  0, width);
+
+    for (int y = y_begin; y < y_end; ++y) {
+        const float* VS_RESTRICT band_row = band + ((y - band_top) * width);
+        T* VS_RESTRICT dst_row = stream_buf != nullptr
+                                     ? stream_buf
+                                     : dst + (y * dst_stride) + x_begin;
+
+        for (int x = x_begin; x < x_end; ++x) {
+            float sum = 0.0F;
+            for (int k = -2; k <= 2; ++k) {
+                int y_tap =
+                    mirror_boundary(y + (k * step), height) - band_top;
+                sum += temp[(y_tap * width) + x] * KERNEL.at(k + 2);
+            }
+
+            float rms = std::sqrt(std::max(sum / 256.0F, 0.0F));
+            float gain = std::min(unit / (rms + eps_val), max_gain);
+            float detail = (band_row[x] * gain) + neutral;
+
+            if constexpr (std::integral<T>) {
+                dst_row[x - x_begin] = static_cast<T>(
+                    std::clamp(std::round(detail), 0.0F, max_val));
+            } else {
+                dst_row[x - x_begin] = detail;
+            }
+        }
+
+        if (stream_buf != nullptr) {
+            stream_row(dst + (y * dst_stride) + x_begin, stream_buf,
+                       (x_end - x_begin) * sizeof(T));
+        }
+    }
+
+    if (stream_buf != nullptr) {
+        stream_fence();
+    }
+}
+
+// Normalized band of the source: temp holds horizontally blurred source
+// rows from temp_top and must cover a 4*step halo around [y_begin, y_end);
+// it is reused for the energy pass of normalize_band.
+template <typename T>
+void conv_v_and_normalize(float* VS_RESTRICT temp, int temp_top,
+                          const T* VS_RESTRICT orig_src, T* VS_RESTRICT dst,
+                          int width, int height, int x_begin, int x_end,
+                          int y_begin, int y_end, ptrdiff_t src_stride,
+                          ptrdiff_t dst_stride, int step_h, int step,
+                          float eps, float max_gain,
+                          const VSVideoFormat* fi,
+                          float* VS_RESTRICT band, float* VS_RESTRICT energy,
+                          T* VS_RESTRICT stream_buf) {
+    const int band_top = std::max(y_begin - (2 * step), 0);
+    const int band_bottom = std::min(y_end + (2 * step), height);
+
+    for (int y = band_top; y < band_bottom; ++y) {
+        const T* VS_RESTRICT src_row = orig_src + (y * src_stride);
+        float* VS_RESTRICT band_row = band + ((y - band_top) * width);
+        float* VS_RESTRICT energy_row = energy + ((y - band_top) * width);
+
+        for (int x = 0; x < width; ++x) {
+            float sum = 0.0F;
+            for (int k = -2; k <= 2; ++k) {
+                int y_tap =
+                    mirror_boundary(y + (k * step), height) - temp_top;
+                sum += temp[(y_tap * width) + x] * KERNEL.at(k + 2);
+            }
+            band_row[x] = static_cast<float>(src_row[x]) - (sum / 256.0F);
+            energy_row[x] = band_row[x] * band_row[x];
+        }
+    }
+
+    normalize_band<T>(band, energy, temp, band_top, band_bottom, dst, width,
+                      height, x_begin, x_end, y_begin, y_end, dst_stride,
+                      step_h, step, eps, max_gain, fi, stream_buf);
+}
+
+// Region of interest in luma coordinates, [left, right) x [top, bottom).
+struct Rect {
+    int left;
+    int top;
+    int right;
+    int bottom;
+};
+
+// The ROI on a width x height plane, rounded outwards on subsampled planes
+// so that every chroma sample touched by a luma pixel of the ROI is included.
+Rect plane_rect(const Rect& roi, const VSVideoFormat& format, int plane,
+                int width, int height) {
+    const int ssw = plane != 0 ? format.subSamplingW : 0;
+    const int ssh = plane != 0 ? format.subSamplingH : 0;
+    return {roi.left >> ssw, roi.top >> ssh,
+            std::min((roi.right + (1 << ssw) - 1) >> ssw, width),
+            std::min((roi.bottom + (1 << ssh) - 1) >> ssh, height)};
+}
+
+// Calls span(y, x_begin, x_end) for every run of a plane outside the ROI.
+template <typename Span>
+void for_each_outside(int width, int height, const Rect& roi, Span span) {
+    for (int y = 0; y < height; ++y) {
+        if (y < roi.top || y >= roi.bottom) {
+            span(y, 0, width);
+            continue;
+        }
+        if (roi.left > 0) {
+            span(y, 0, roi.left);
+        }
+        if (roi.right < width) {
+            span(y, roi.right, width);
+        }
+    }
+}
+
+// Reads the optional left/top/width/height arguments. width and height
+// default to the rest of the frame.
+Rect read_roi(const VSMap* in, const VSVideoInfo& vi, const VSAPI* vsapi) {
+    int err = 0;
+    Rect roi{};
+    roi.left = vsh::int64ToIntS(vsapi->mapGetInt(in, "left", 0, &err));
+    roi.top = vsh::int64ToIntS(vsapi->mapGetInt(in, "top", 0, &err));
+
+    int width = vsh::int64ToIntS(vsapi->mapGetInt(in, "width", 0, &err));
+    if (err != 0) {
+        width = vi.width - roi.left;
+    }
+
+    int height = vsh::int64ToIntS(vsapi->mapGetInt(in, "height", 0, &err));
+    if (err != 0) {
+        height = vi.height - roi.top;
+    }
+
+    roi.right = roi.left + width;
+    roi.bottom = roi.top + height;
+    return roi;
+}
+
+// Reads an optional per-plane array into values. Planes past the end of the
+// array repeat its last value, so a single value applies to every plane.
+// Returns false if more than one value per plane is given.
+bool read_plane_values(const VSMap* in, const char* key,
+                       std::array<int, 3>& values, const VSAPI* vsapi) {
+    const int count = vsapi->mapNumElements(in, key);
+    if (count > static_cast<int>(values.size())) {
+        return false;
+    }
+    for (int plane = 0; count > 0 && plane < 3; ++plane) {
+        values[plane] = vsh::int64ToIntS(
+            vsapi->mapGetInt(in, key, std::min(plane, count - 1), nullptr));
+    }
+    return true;
+}
+
+bool is_valid_roi(const Rect& roi, const VSVideoInfo& vi) noexcept {
+    return roi.left >= 0 && roi.top >= 0 && roi.left < roi.right &&
+           roi.top < roi.bottom && roi.right <= vi.width &&
+           roi.bottom <= vi.height;
+}
+
+// Name of the frame property given by the argument key, or an empty string.
+std::string read_prop_name(const VSMap* in, const char* key,
+                           const VSAPI* vsapi) {
+    int err = 0;
+    const char* name = vsapi->mapGetData(in, key, 0, &err);
+    return err == 0 ? name : std::string{};
+}
+
+// Per-frame value of a parameter: the frame property named key, or fallback
+// if key is empty or the frame has no numeric property of that name.
+float frame_param(const VSFrame* frame, const std::string& key,
+                  float fallback, const VSAPI* vsapi) {
+    if (key.empty()) {
+        return fallback;
+    }
+    const VSMap* props = vsapi->getFramePropertiesRO(frame);
+    int err = 0;
+    const double value = vsapi->mapGetFloat(props, key.c_str(), 0, &err);
+    if (err == 0) {
+        return static_cast<float>(value);
+    }
+    const int64_t int_value = vsapi->mapGetInt(props, key.c_str(), 0, &err);
+    return err == 0 ? static_cast<float>(int_value) : fallback;
+}
+
+class StripPool;
+
+struct ATWTData {
+    VSNode* node;
+    VSVideoInfo vi;
+    Rect roi;
+    // Per plane; a plane with both radii 0 gets a zero detail.
+    std::array<int, 3> radius_h;
+    std::array<int, 3> radius_v;
+    int threads;
+    // Workers for threads > 1, shared by the nodes of one Decompose.
+    std::shared_ptr<StripPool> pool;
+    bool normalize;
+    float eps;
+    float max_gain;
+    bool lossless;
+    // Frame properties overriding eps and max_gain per frame.
+    std::string prop_eps;
+    std::string prop_max_gain;
+};
+
+// Scratch budget for one strip of horizontally blurred rows. Strips carry
+// their own 2*step halo (4*step when normalizing), so peak scratch memory is
+// bounded by this instead of the plane size and the rows are still cached
+// for the vertical pass.
+constexpr std::size_t STRIP_BYTES = std::size_t{1} << 20;
+
+int strip_rows(int width, int height, int step) {
+    const auto rows =
+        static_cast<int>(STRIP_BYTES / (sizeof(float) * std::max(width, 1)));
+    return std::min(std::max(rows, 8 * step), height);
+}
+
+// Rows of horizontally blurred scratch that the horizontal pass runs ahead
+// of the vertical pass within a strip: small enough that the chunk and its
+// source rows are still cached when the vertical pass reads them, and a
+// multiple of every vertical block run.
+constexpr std::size_t PIPELINE_BYTES = std::size_t{64} << 10;
+
+// Source rows of the next chunk touched ahead of time. Hinting a whole chunk
+// queues more misses than the core can track and stalls the current one;
+// the leading rows are enough for the hardware prefetcher to pick up.
+constexpr int PREFETCH_ROWS = 2;
+
+int pipeline_rows(int width, int step) {
+    const int run = VERTICAL_MAX_BLOCK_ROWS * step;
+    const auto rows = static_cast<int>(PIPELINE_BYTES /
+                                       (sizeof(float) * std::max(width, 1)));
+    return std::max((rows + run - 1) / run, 1) * run;
+}
+
+// Worker threads of one filter instance, started once and kept for its
+// lifetime. All frames in flight share them, so `threads` bounds the extra
+// threads of a filter instead of multiplying with VapourSynth's own frame
+// threads, and no thread is created on the frame path.
+class StripPool {
+  public:
+    explicit StripPool(int workers) {
+        threads.reserve(workers);
+        for (int i = 0; i < workers; ++i) {
+            threads.emplace_back(
+                [this](const std::stop_token& stop) { serve(stop); });
+        }
+    }
+
+    // Runs work on the calling thread and on up to `helpers` idle workers,
+    // and returns once every copy that started has finished. Copies that
+    // are still queued when the caller is done are dropped, so a pool busy
+    // with other frames never holds this one up.
+    void run(int helpers, const std::function<void()>& work) {
+        auto job = std::make_shared<Job>(&work);
+        {
+            const std::lock_guard lock(mutex);
+            for (int i = 0; i < helpers; ++i) {
+                queue.push_back(job);
+            }
+        }
+        wake.notify_all();
+
+        work();
+
+        std::unique_lock lock(mutex);
+        job->closed = true;
+        done.wait(lock, [&] { return job->active == 0; });
+    }
+
+  private:
+    struct Job {
+        explicit Job(const std::function<void()>* work) : work(work) {}
+        const std::function<void()>* work;
+        int active = 0;
+        bool closed = false;
+    };
+
+    void serve(const std::stop_token& stop) {
+        std::unique_lock lock(mutex);
+        while (wake.wait(lock, stop, [&] { return !queue.empty(); })) {
+            const std::shared_ptr<Job> job = std::move(queue.front());
+            queue.pop_front();
+            if (job->closed) {
+                continue;
+            }
+            ++job->active;
+            lock.unlock();
+            (*job->work)();
+            lock.lock();
+            if (--job->active == 0) {
+                done.notify_all();
+            }
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable_any wake;
+    std::condition_variable done;
+    std::deque<std::shared_ptr<Job>> queue;
+    // Last, so the workers are stopped and joined before the rest goes.
+    std::vector<std::jthread> threads;
+};
+
+// Creates the pool of a filter running `threads` workers per frame, the
+// calling thread being one of them.
+std::shared_ptr<StripPool> make_strip_pool(int threads) {
+    return threads > 1 ? std::make_shared<StripPool>(threads - 1) : nullptr;
+}
+
+// Runs body(strip) for every strip index, spread over up to `threads`
+// workers of pool and the calling thread. Each worker calls init() once to
+// set up its own scratch.
+template <typename Init, typename Body>
+void for_each_strip(StripPool* pool, int strips, int threads, Init init,
+                    Body body) {
+    std::atomic<int> next{0};
+    const std::function<void()> worker = [&] {
+        // A helper that starts after the last strip is taken has no work.
+        if (next.load() >= strips) {
+            return;
+        }
+        auto scratch = init();
+        for (int i = next++; i < strips; i = next++) {
+            body(scratch, i);
+        }
+    };
+
+    const int helpers = std::min(threads, strips) - 1;
+    if (pool == nullptr || helpers <= 0) {
+        worker();
+        return;
+    }
+    pool->run(helpers, worker);
+}
+
+// Scratch budget for the rings of one cascade tile, about the size of a
+// level 2 cache.
+constexpr std::size_t CASCADE_BYTES = std::size_t{1} << 20;
+
+// Ring rows of every level of a cascade tile, see cascade_tile.
+struct CascadeScratch {
+    std::vector<float> base;
+    std::vector<float> temp;
+    std::vector<float> acc;
+    std::vector<float> blur;
+    std::vector<float> last;
+};
+
+// Halo of a cascade of `levels` levels from `level` on: every level's
+// horizontal blur uses 2*step columns of it.
+constexpr int cascade_halo(int levels, int level = 0) noexcept {
+    return 2 * ((1 << levels) - (1 << level));
+}
+
+// Output columns of one cascade tile: as many as fit CASCADE_BYTES, split
+// over `threads`, but at least eight times the halo so that the halo both
+// sides recompute adds at most a quarter of the work.
+int cascade_tile_width(int width, int levels, int threads) {
+    const int halo = cascade_halo(levels);
+    // Rows per column: base and blur rings of 4*step + 1 rows per level and
+    // the accumulator ring.
+    const int rows = (2 * ((2 * halo) + levels)) + halo + 1;
+    const int fit =
+        static_cast<int>(CASCADE_BYTES / (sizeof(float) * rows)) - (2 * halo);
+    const int per_thread = (width + threads - 1) / threads;
+    return std::min(std::max(std::min(fit, per_thread), 8 * halo), width);
+}
+
+// The multi-level cascade of Decompose as a row wavefront over the output
+// columns [left, right) of a plane. Level k (step 2^k) blurs row y of its
+// base as soon as rows y +- 2*step are in and passes the next base of row y
+// straight to level k + 1, so each level only keeps a ring of 4*step + 1
+// rows, and all levels of a tile are done while its rows are still cached
+// instead of in one pass over plane-sized buffers per level. The tile reads
+// cascade_halo() columns beyond its edges, which its horizontal blurs use
+// up level by level.
+//
+// load(y, x_begin, x_end, base) fills source row y. level(k, y, x_begin,
+// x_end, base, blur, next, acc) gets row y of level k's base and its blur
+// (the detail being base - blur) and writes the base of level k + 1 to next.
+// acc is a zeroed row that lives from the load of row y until store(y,
+// left, right, base, acc) gets the last base. Rows point at column x_begin.
+template <typename Load, typename Level, typename Store>
+void cascade_tile(int width, int height, int levels, int left, int right,
+                  CascadeScratch& s, Load load, Level level, Store store) {
+    // Columns of the base of level k.
+    auto window = [&](int k) {
+        const int halo = cascade_halo(levels, k);
+        return std::pair{std::max(left - halo, 0),
+                         std::min(right + halo, width)};
+    };
+
+    struct Ring {
+        int begin;
+        int end;
+        int rows;
+        std::size_t base;
+        std::size_t temp;
+        int next;
+    };
+    std::vector<Ring> rings(levels);
+    std::size_t base_size = 0;
+    std::size_t temp_size = 0;
+    for (int k = 0; k < levels; ++k) {
+        const auto [begin, end] = window(k);
+        const auto [temp_begin, temp_end] = window(k + 1);
+        rings[k] = {begin, end, (4 << k) + 1, base_size, temp_size, 0};
+        base_size += static_cast<std::size_t>(end - begin) * rings[k].rows;
+        temp_size +=
+            static_cast<std::size_t>(temp_end - temp_begin) * rings[k].rows;
+    }
+
+    const auto [acc_begin, acc_end] = window(0);
+    const int acc_width = acc_end - acc_begin;
+    const int acc_rows = cascade_halo(levels) + 1;
+    s.base.resize(base_size);
+    s.temp.resize(temp_size);
+    s.acc.resize(static_cast<std::size_t>(acc_width) * acc_rows);
+    s.blur.resize(acc_width);
+    s.last.resize(right - left);
+
+    auto base_row = [&](int k, int y) {
+        const Ring& ring = rings[k];
+        return s.base.data() + ring.base +
+               (static_cast<std::size_t>(y % ring.rows) *
+                (ring.end - ring.begin));
+    };
+    auto temp_row = [&](int k, int y) {
+        const Ring& ring = rings[k];
+        const auto [begin, end] = window(k + 1);
+        return s.temp.data() + ring.temp +
+               (static_cast<std::size_t>(y % ring.rows) * (end - begin));
+    };
+    auto acc_row = [&](int y) {
+        return s.acc.data() +
+               (static_cast<std::size_t>(y % acc_rows) * acc_width);
+    };
+
+    // Takes row r of level k's base and emits every row whose taps are in.
+    // The bottom rows reflect onto rows before r, so the last row emits the
+    // rest of the plane.
+    auto feed = [&](auto& self, int k, int r) -> void {
+        Ring& ring = rings[k];
+        const int step = 1 << k;
+        const auto [begin, end] = window(k + 1);
+        const int n = end - begin;
+        conv_h<float>(base_row(k, r) - ring.begin, temp_row(k, r), width, 1,
+                      0, step, begin, end);
+
+        for (; ring.next < height &&
+               std::min(ring.next + (2 * step), height - 1) <= r;
+             ++ring.next) {
+            const int y = ring.next;
+            std::array<const float*, 5> t{};
+            for (int i = 0; i < 5; ++i) {
+                t[i] = temp_row(k, mirror_boundary(y + ((i - 2) * step),
+                                                   height));
+            }
+            float* VS_RESTRICT blur = s.blur.data();
+            for (int x = 0; x < n; ++x) {
+                blur[x] = ((t[0][x] + t[4][x]) + (4.0F * (t[1][x] + t[3][x])) +
+                           (6.0F * t[2][x])) /
+                          256.0F;
+            }
+
+            const bool last = k + 1 == levels;
+            float* next = last ? s.last.data() : base_row(k + 1, y);
+            float* acc = acc_row(y) + (begin - acc_begin);
+            level(k, y, begin, end, base_row(k, y) + (begin - ring.begin),
+                  blur, next, acc);
+            if (last) {
+                store(y, left, right, next, acc);
+            } else {
+                self(self, k + 1, y);
+            }
+        }
+    };
+
+    for (int y = 0; y < height; ++y) {
+        std::fill_n(acc_row(y), acc_width, 0.0F);
+        load(y, rings[0].begin, rings[0].end, base_row(0, y));
+        feed(feed, 0, y);
+    }
+}
+
+// A packed pyramid stacks the details of all levels and the base vertically
+// in one frame of height (levels + 1) * height, in the order Decompose
+// returns them. Frames carry the level count and the first luma row of each
+// layer.
+constexpr const char* PACKED_LEVELS_PROP = "ATWTLevels";
+constexpr const char* PACKED_OFFSETS_PROP = "ATWTOffsets";
+
+// Copies height rows of a plane between frames, at row offsets.
+void copy_plane_rows(const VSFrame* src, int src_row, VSFrame* dst,
+                     int dst_row, int plane, int height, const VSAPI* vsapi) {
+    const ptrdiff_t src_stride = vsapi->getStride(src, plane);
+    const ptrdiff_t dst_stride = vsapi->getStride(dst, plane);
+    const std::size_t row_bytes =
+        static_cast<std::size_t>(vsapi->getFrameWidth(dst, plane)) *
+        vsapi->getVideoFrameFormat(dst)->bytesPerSample;
+    const uint8_t* srcp =
+        vsapi->getReadPtr(src, plane) + (src_row * src_stride);
+    uint8_t* dstp = vsapi->getWritePtr(dst, plane) + (dst_row * dst_stride);
+
+    for (int y = 0; y < height; ++y) {
+        std::memcpy(dstp + (y * dst_stride), srcp + (y * src_stride),
+                    row_bytes);
+    }
+}
+
+// Whether a clip can hold a packed pyramid of `levels` levels: its height
+// splits into levels + 1 layers of whole chroma rows.
+bool is_packed_shape(const VSVideoInfo& vi, int levels) noexcept {
+    return levels >= 1 && vi.height % (levels + 1) == 0 &&
+           (vi.height / (levels + 1)) % (1 << vi.format.subSamplingH) == 0;
+}
+
+// The level count of a packed pyramid is given when a filter is created, so
+// no frame has to be rendered then; every frame is checked against it.
+bool packed_levels_match(const VSFrame* frame, int levels,
+                         const VSAPI* vsapi) {
+    int err = 0;
+    const int64_t frame_levels = vsapi->mapGetInt(
+        vsapi->getFramePropertiesRO(frame), PACKED_LEVELS_PROP, 0, &err);
+    return err == 0 && frame_levels == levels;
+}
+
+std::string packed_levels_error(const char* filter, int n, int levels) {
+    return std::string(filter) + ": frame " + std::to_string(n) +
+           " is not a packed pyramid of " + std::to_string(levels) +
+           " levels";
+}
+
+// Sums one or more details onto a base. Decompose also uses it with
+// subtract set, to peel a detail off and get the next level's base.
+struct ReplaceData {
+    VSNode* base;
+    std::vector<VSNode*> details;
+    // Per-level weight maps: one clip per detail, or with weight_planes a
+    // single clip whose plane k weights detail k.
+    std::vector<VSNode*> weights;
+    bool weight_planes;
+    VSNode* mask;
+    // Overshoot limiting: the result is kept within overshoot of the local
+    // min/max of reference (or base) over a (2*overshoot_radius+1)^2 window.
+    VSNode* reference;
+    bool limit_overshoot;
+    float overshoot;
+    int overshoot_radius;
+    // Strength of the summed detail.
+    float gain;
+    // Frame properties of base overriding gain and overshoot per frame.
+    std::string prop_gain;
+    std::string prop_overshoot;
+    VSVideoInfo vi;
+    Rect roi;
+    bool first_plane;
+    bool subtract;
+    // base is a packed pyramid; details holds one reference to it per level.
+    bool packed;
+};
+
+// Frames of one output frame's ReplaceData inputs.
+struct ReplaceFrames {
+    const VSFrame* base;
+    std::vector<const VSFrame*> details;
+    std::vector<const VSFrame*> weights;
+    const VSFrame* mask;
+    const VSFrame* reference;
+    // Parameters of this frame.
+    float gain;
+    float overshoot;
+};
+
+template <typename T, typename D>
+void extract_plane_strips(const VSFrame* src, VSFrame* dst, int plane,
+                          const ATWTData* d, float eps, float max_gain,
+                          const VSAPI* vsapi) {
+    const int width = vsapi->getFrameWidth(src, plane);
+    const int height = vsapi->getFrameHeight(src, plane);
+    const ptrdiff_t src_stride = vsapi->getStride(src, plane) / sizeof(T);
+    const ptrdiff_t dst_stride = vsapi->getStride(dst, plane) / sizeof(D);
+    const VSVideoFormat* dfi = &d->vi.format;
+
+    const T* VS_RESTRICT srcp =
+        reinterpret_cast<const T*>(vsapi->getReadPtr(src, plane));
+    D* VS_RESTRICT dstp = reinterpret_cast<D*>(vsapi->getWritePtr(dst, plane));
+
+    // A radius of 0 skips that axis.
+    const int radius_h = d->radius_h[plane];
+    const int radius_v = d->radius_v[plane];
+    const int step_h = radius_h > 0 ? 1 << (radius_h - 1) : 0;
+    const int step = radius_v > 0 ? 1 << (radius_v - 1) : 0;
+
+    // Only the ROI is transformed, reading the source around it as halo;
+    // everything outside gets a zero detail, as does a plane with no radius.
+    const Rect roi = step_h > 0 || step > 0 ? plane_rect(d->roi, d->vi.format,
+                                                         plane, width, height)
+                                            : Rect{};
+    const auto neutral = static_cast<D>(get_neutral<D>(dfi));
+    for_each_outside(width, height, roi, [&](int y, int x_begin, int x_end) {
+        std::fill_n(dstp + (y * dst_stride) + x_begin, x_end - x_begin,
+                    neutral);
+    });
+    if (roi.left == roi.right) {
+        return;
+    }
+
+    const float kernel_sum = (step_h > 0 ? 16.0F : 1.0F) * 16.0F;
+    const int halo = (d->normalize ? 4 : 2) * step;
+
+    // Columns of the horizontal blur. Normalizing also needs the band
+    // 2*step_h beyond the ROI for the horizontal energy blur.
+    const int halo_h = d->normalize ? 2 * step_h : 0;
+    const int x_begin = std::max(roi.left - halo_h, 0);
+    const int x_end = std::min(roi.right + halo_h, width);
+    const int temp_width = x_end - x_begin;
+    const int roi_width = roi.right - roi.left;
+    const int roi_height = roi.bottom - roi.top;
+
+    const int rows = strip_rows(temp_width, roi_height, step);
+    const bool stream = use_stream_stores<D>(width, height);
+    const auto scratch_size =
+        static_cast<size_t>(temp_width) * (rows + 2 * halo);
+
+    struct Scratch {
+        std::vector<float> temp;
+        std::vector<float> band;
+        std::vector<float> energy;
+        std::vector<D> stream;
+    };
+
+    for_each_strip(
+        d->pool.get(), (roi_height + rows - 1) / rows, d->threads,
+        [&] {
+            return Scratch{std::vector<float>(scratch_size),
+                           std::vector<float>(d->normalize ? scratch_size : 0),
+                           std::vector<float>(d->normalize ? scratch_size : 0),
+                           std::vector<D>(stream ? VERTICAL_MAX_BLOCK_ROWS *
+                                                       temp_width
+                                                 : 0)};
+        },
+        [&](Scratch& scratch, int strip) {
+            const int y_begin = roi.top + (strip * rows);
+            const int y_end = std::min(y_begin + rows, roi.bottom);
+            const int top = std::max(y_begin - halo, 0);
+            const int bottom = std::min(y_end + halo, height);
+
+            D* stream_buf = stream ? scratch.stream.data() : nullptr;
+
+            auto vertical_pass = [&](auto vertical, const auto* taps,
+                                     ptrdiff_t tap_stride, int tap_top,
+                                     int y0, int y1) {
+                using S = std::remove_cvref_t<decltype(*taps)>;
+                constexpr bool V = decltype(vertical)::value;
+                if (d->lossless) {
+                    conv_v_and_extract<T, D, S, V, true>(
+                        taps, tap_stride, tap_top, srcp + roi.left,
+                        dstp + roi.left, roi_width, height, y0, y1,
+                        src_stride, dst_stride, step, kernel_sum, dfi,
+                        stream_buf);
+                } else {
+                    conv_v_and_extract<T, D, S, V, false>(
+                        taps, tap_stride, tap_top, srcp + roi.left,
+                        dstp + roi.left, roi_width, height, y0, y1,
+                        src_stride, dst_stride, step, kernel_sum, dfi,
+                        stream_buf);
+                }
+            };
+
+            if (step_h == 0) {
+                vertical_pass(std::true_type{}, srcp + roi.left, src_stride,
+                              0, y_begin, y_end);
+                return;
+            }
+
+            auto horizontal_pass = [&](int y0, int y1) {
+                conv_h<T>(srcp + (y0 * src_stride),
+                          scratch.temp.data() + ((y0 - top) * temp_width),
+                          width, y1 - y0, src_stride, step_h, x_begin, x_end);
+            };
+
+            // Lossless details are never normalized.
+            if (!d->normalize || !std::is_same_v<T, D>) {
+                // Software pipeline over chunks of rows: the horizontal pass
+                // of a chunk and the 2*step rows below it is followed right
+                // away by the vertical pass of the chunk, which finds the
+                // blurred rows and the source rows it subtracts still
+                // cached, while the leading source rows of the next chunk
+                // are prefetched. Rows near the bottom reflect onto rows above
+                // them, so the last chunk blurs up to the end of the strip.
+                const int chunk = pipeline_rows(temp_width, std::max(step, 1));
+                const auto x_from = static_cast<std::size_t>(
+                    std::max(x_begin - (2 * step_h), 0));
+                const auto prefetch_bytes =
+                    (std::min(x_end + (2 * step_h), width) - x_from) *
+                    sizeof(T);
+                int blurred = top;
+                for (int y0 = y_begin; y0 < y_end; y0 += chunk) {
+                    const int y1 = std::min(y0 + chunk, y_end);
+                    const int need = std::min(y1 + (2 * step), bottom);
+                    horizontal_pass(blurred, need);
+                    blurred = need;
+                    prefetch_rows(srcp + (blurred * src_stride) + x_from,
+                                  src_stride * sizeof(T),
+                                  std::min(PREFETCH_ROWS, bottom - blurred),
+                                  prefetch_bytes);
+                    if (step == 0) {
+                        vertical_pass(std::false_type{}, scratch.temp.data(),
+                                      temp_width, top, y0, y1);
+                    } else {
+                        vertical_pass(std::true_type{}, scratch.temp.data(),
+                                      temp_width, top, y0, y1);
+                    }
+                }
+                return;
+            }
+
+            // Normalizing reuses the blurred rows for the energy pass, so it
+            // takes the whole strip at once.
+            horizontal_pass(top, bottom);
+            if constexpr (std::is_same_v<T, D>) {
+                conv_v_and_normalize<T>(
+                    scratch.temp.data(), top, srcp + x_begin, dstp + x_begin,
+                    temp_width, height, roi.left - x_begin,
+                    roi.right - x_begin, y_begin, y_end, src_stride,
+                    dst_stride, step_h, step, eps, max_gain, dfi,
+                    scratch.band.data(), scratch.energy.data(), stream_buf);
+            }
+        });
+}
+
+template <typename T>
+void process_extract_plane(const VSFrame* src, VSFrame* dst, int plane,
+                           const ATWTData* d, float eps, float max_gain,
+                           const VSAPI* vsapi) {
+    if constexpr (std::integral<T>) {
+        if (d->lossless) {
+            if (d->vi.format.bytesPerSample == 2) {
+                extract_plane_strips<T, uint16_t>(src, dst, plane, d, eps,
+                                                  max_gain, vsapi);
+            } else {
+                extract_plane_strips<T, uint32_t>(src, dst, plane, d, eps,
+                                                  max_gain, vsapi);
+            }
+            return;
+        }
+    }
+    extract_plane_strips<T, T>(src, dst, plane, d, eps, max_gain, vsapi);
+}
+
+const VSFrame* VS_CC ExtractGetFrame(int n, int activationReason,
+                                     void* instanceData,
+                                     [[maybe_unused]] void** frameData,
+                                     VSFrameContext* frameCtx, VSCore* core,
+                                     const VSAPI* vsapi) {
+    auto* d = static_cast<ATWTData*>(instanceData);
+
+    if (activationReason == arInitial) {
+        vsapi->requestFrameFilter(n, d->node, frameCtx);
+    } else if (activationReason == arAllFramesReady) {
+        const VSFrame* src = vsapi->getFrameFilter(n, d->node, frameCtx);
+        const VSVideoFormat* fi = vsapi->getVideoFrameFormat(src);
+
+        const float eps = frame_param(src, d->prop_eps, d->eps, vsapi);
+        const float max_gain =
+            frame_param(src, d->prop_max_gain, d->max_gain, vsapi);
+        if (eps <= 0.0F || max_gain <= 0.0F) {
+            vsapi->setFilterError("ExtractFrequency: eps and max_gain must "
+                                  "be > 0",
+                                  frameCtx);
+            vsapi->freeFrame(src);
+            return nullptr;
+        }
+
+        VSFrame* dst = vsapi->newVideoFrame(
+            &d->vi.format, vsapi->getFrameWidth(src, 0),
+            vsapi->getFrameHeight(src, 0), src, core);
+
+        for (int plane = 0; plane < fi->numPlanes; plane++) {
+            if (fi->sampleType == stInteger) {
+                switch (fi->bytesPerSample) {
+                case 1:
+                    process_extract_plane<uint8_t>(src, dst, plane, d, eps,
+                                                   max_gain, vsapi);
+                    break;
+                case 2:
+                    process_extract_plane<uint16_t>(src, dst, plane, d, eps,
+                                                    max_gain, vsapi);
+                    break;
+                case 4:
+                    process_extract_plane<uint32_t>(src, dst, plane, d, eps,
+                                                    max_gain, vsapi);
+                    break;
+                }
+            } else if (fi->sampleType == stFloat) {
+                switch (fi->bytesPerSample) {
+                case 4:
+                    process_extract_plane<float>(src, dst, plane, d, eps,
+                                                 max_gain, vsapi);
+                    break;
+                }
+            }
+        }
+
+        vsapi->freeFrame(src);
+        return dst;
+    }
+    return nullptr;
+}
+
+void VS_CC ExtractFree(void* instanceData, [[maybe_unused]] VSCore* core,
+                       const VSAPI* vsapi) {
+    auto d = std::unique_ptr<ATWTData>(static_cast<ATWTData*>(instanceData));
+    vsapi->freeNode(d->node);
+}
+
+void VS_CC ExtractCreate(const VSMap* in, VSMap* out,
+                         [[maybe_unused]] void* userData, VSCore* core,
+                         const VSAPI* vsapi) {
+    auto d = std::make_unique<ATWTData>();
+    int err = 0;
+
+    d->node = vsapi->mapGetNode(in, "clip", 0, 0);
+    d->vi = *vsapi->getVideoInfo(d->node);
+
+    std::array<int, 3> radius = {1, 1, 1};
+    if (!read_plane_values(in, "radius", radius, vsapi)) {
+        vsapi->mapSetError(out, "ExtractFrequency: radius takes at most one "
+                                "value per plane");
+        vsapi->freeNode(d->node);
+        return;
+    }
+
+    d->radius_h = radius;
+    d->radius_v = radius;
+    if (!read_plane_values(in, "radius_h", d->radius_h, vsapi) ||
+        !read_plane_values(in, "radius_v", d->radius_v, vsapi)) {
+        vsapi->mapSetError(out, "ExtractFrequency: radius_h and radius_v "
+                                "take at most one value per plane");
+        vsapi->freeNode(d->node);
+        return;
+    }
+
+    for (int plane = 0; plane < 3; ++plane) {
+        if (radius[plane] < 1) {
+            vsapi->mapSetError(out, "ExtractFrequency: radius must be >= 1");
+            vsapi->freeNode(d->node);
+            return;
+        }
+
+        if (d->radius_h[plane] < 0 || d->radius_v[plane] < 0 ||
+            (d->radius_h[plane] == 0 && d->radius_v[plane] == 0)) {
+            vsapi->mapSetError(out, "ExtractFrequency: radius_h and radius_v "
+                                    "must be >= 0 and not both 0");
+            vsapi->freeNode(d->node);
+            return;
+        }
+    }
+
+    d->threads = vsh::int64ToIntS(vsapi->mapGetInt(in, "threads", 0, &err));
+    if (err != 0) {
+        d->threads = 1;
+    }
+
+    if (d->threads < 0) {
+        vsapi->mapSetError(out, "ExtractFrequency: threads must be >= 0");
+        vsapi->freeNode(d->node);
+        return;
+    }
+
+    if (d->threads == 0) {
+        d->threads =
+            std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+    }
+
+    d->normalize = vsapi->mapGetInt(in, "normalize", 0, &err) != 0;
+
+    d->eps = vsapi->mapGetFloatSaturated(in, "eps", 0, &err);
+    if (err != 0) {
+        d->eps = 1e-4F;
+    }
+
+    d->max_gain = vsapi->mapGetFloatSaturated(in, "max_gain", 0, &err);
+    if (err != 0) {
+        d->max_gain = 8.0F;
+    }
+
+    d->prop_eps = read_prop_name(in, "prop_eps", vsapi);
+    d->prop_max_gain = read_prop_name(in, "prop_max_gain", vsapi);
+
+    if (d->eps <= 0.0F || d->max_gain <= 0.0F) {
+        vsapi->mapSetError(out,
+                           "ExtractFrequency: eps and max_gain must be > 0");
+        vsapi->freeNode(d->node);
+        return;
+    }
+
+    d->lossless = vsapi->mapGetInt(in, "lossless", 0, &err) != 0;
+
+    if (d->normalize &&
+        (std::ranges::find(d->radius_h, 0) != d->radius_h.end() ||
+         std::ranges::find(d->radius_v, 0) != d->radius_v.end())) {
+        vsapi->mapSetError(out, "ExtractFrequency: normalize needs both axes");
+        vsapi->freeNode(d->node);
+        return;
+    }
+
+    if (!vsh::isConstantVideoFormat(&d->vi)) {
+        vsapi->mapSetError(
+            out,
+            "ExtractFrequency: only clips with constant format are accepted");
+        vsapi->freeNode(d->node);
+        return;
+    }
+
+    if (!is_supported_format(d->vi.format)) {
+        vsapi->mapSetError(out, "ExtractFrequency: only 8-16 bit "
+                                "integer or 32 bit float input "
+                                "are accepted");
+        vsapi->freeNode(d->node);
+        return;
+    }
+
+    if (!levels_fit(d->vi, d->radius_h, d->radius_v)) {
+        vsapi->mapSetError(out, "ExtractFrequency: 2^radius must be smaller "
+                                "than the width and height of every plane");
+        vsapi->freeNode(d->node);
+        return;
+    }
+
+    d->roi = read_roi(in, d->vi, vsapi);
+    if (!is_valid_roi(d->roi, d->vi)) {
+        vsapi->mapSetError(out, "ExtractFrequency: left, top, width and "
+                                "height must give a non-empty rectangle "
+                                "inside the frame");
+        vsapi->freeNode(d->node);
+        return;
+    }
+
+    if (d->lossless) {
+        if (d->vi.format.sampleType != stInteger || d->normalize) {
+            vsapi->mapSetError(out,
+                               "ExtractFrequency: lossless requires integer "
+                               "input and cannot be combined with normalize");
+            vsapi->freeNode(d->node);
+            return;
+        }
+        vsapi->queryVideoFormat(
+            &d->vi.format, d->vi.format.colorFamily, stInteger,
+            lossless_detail_bits(d->vi.format.bitsPerSample),
+            d->vi.format.subSamplingW, d->vi.format.subSamplingH, core);
+    }
+
+    d->pool = make_strip_pool(d->threads);
+
+    VSFilterDependency deps[] = {{d->node, rpStrictSpatial}};
+    auto* data = d.release();
+    vsapi->createVideoFilter(out, "ExtractFrequency", &data->vi,
+                             ExtractGetFrame, ExtractFree, fmParallel,
+                             std::data(deps), 1, data, core);
+}
+
+// Normalizes a detail that is already extracted, for Decompose: d->node is
+// the raw detail of the level, which the next base is built from, so the
+// level's blur is computed once for both. Planes without a radius keep their
+// neutral detail.
+template <typename T>
+void normalize_detail_plane(const VSFrame* src, VSFrame* dst, int plane,
+                            const ATWTData* d, float eps, float max_gain,
+                            const VSAPI* vsapi) {
+    const int width = vsapi->getFrameWidth(src, plane);
+    const int height = vsapi->getFrameHeight(src, plane);
+    const ptrdiff_t src_stride = vsapi->getStride(src, plane) / sizeof(T);
+    const ptrdiff_t dst_stride = vsapi->getStride(dst, plane) / sizeof(T);
+    const auto* srcp =
+        reinterpret_cast<const T*>(vsapi->getReadPtr(src, plane));
+    auto* dstp = reinterpret_cast<T*>(vsapi->getWritePtr(dst, plane));
+    const VSVideoFormat* fi = &d->vi.format;
+
+    if (d->radius_h[plane] == 0) {
+        copy_plane_rows(src, 0, dst, 0, plane, height, vsapi);
+        return;
+    }
+
+    const int step_h = 1 << (d->radius_h[plane] - 1);
+    const int step = 1 << (d->radius_v[plane] - 1);
+    const auto neutral = static_cast<T>(get_neutral<T>(fi));
+    const int halo = 2 * step;
+    const int rows = strip_rows(width, height, step);
+    const bool stream = use_stream_stores<T>(width, height);
+    const auto scratch_size =
+        static_cast<std::size_t>(width) * (rows + (2 * halo));
+
+    struct Scratch {
+        std::vector<float> band;
+        std::vector<float> energy;
+        std::vector<float> temp;
+        std::vector<T> stream;
+    };
+
+    for_each_strip(
+        d->pool.get(), (height + rows - 1) / rows, d->threads,
+        [&] {
+            return Scratch{std::vector<float>(scratch_size),
+                           std::vector<float>(scratch_size),
+                           std::vector<float>(scratch_size),
+                           std::vector<T>(stream ? width : 0)};
+        },
+        [&](Scratch& scratch, int strip) {
+            const int y_begin = strip * rows;
+            const int y_end = std::min(y_begin + rows, height);
+            const int top = std::max(y_begin - halo, 0);
+            const int bottom = std::min(y_end + halo, height);
+
+            for (int y = top; y < bottom; ++y) {
+                const T* VS_RESTRICT src_row = srcp + (y * src_stride);
+                float* VS_RESTRICT band_row =
+                    scratch.band.data() + ((y - top) * width);
+                float* VS_RESTRICT energy_row =
+                    scratch.energy.data() + ((y - top) * width);
+                for (int x = 0; x < width; ++x) {
+                    band_row[x] = centered(src_row[x], neutral);
+                    energy_row[x] = band_row[x] * band_row[x];
+                }
+            }
+
+            normalize_band<T>(scratch.band.data(), scratch.energy.data(),
+                              scratch.temp.data(), top, bottom, dstp, width,
+                              height, 0, width, y_begin, y_end, dst_stride,
+                              step_h, step, eps, max_gain, fi,
+                              stream ? scratch.stream.data() : nullptr);
+        });
+}
+
+const VSFrame* VS_CC NormalizeGetFrame(int n, int activationReason,
+                                       void* instanceData,
+                                       [[maybe_unused]] void** frameData,
+                                       VSFrameContext* frameCtx, VSCore* core,
+                                       const VSAPI* vsapi) {
+    auto* d = static_cast<ATWTData*>(instanceData);
+
+    if (activationReason == arInitial) {
+        vsapi->requestFrameFilter(n, d->node, frameCtx);
+    } else if (activationReason == arAllFramesReady) {
+        const VSFrame* src = vsapi->getFrameFilter(n, d->node, frameCtx);
+        const VSVideoFormat* fi = vsapi->getVideoFrameFormat(src);
+
+        // The raw detail carries the properties of the source frame.
+        const float eps = frame_param(src, d->prop_eps, d->eps, vsapi);
+        const float max_gain =
+            frame_param(src, d->prop_max_gain, d->max_gain, vsapi);
+        if (eps <= 0.0F || max_gain <= 0.0F) {
+            vsapi->setFilterError("Decompose: eps and max_gain must be > 0",
+                                  frameCtx);
+            vsapi->freeFrame(src);
+            return nullptr;
+        }
+
+        VSFrame* dst = vsapi->newVideoFrame(fi, vsapi->getFrameWidth(src, 0),
+                                            vsapi->getFrameHeight(src, 0),
+                                            src, core);
+
+        for (int plane = 0; plane < fi->numPlanes; plane++) {
+            if (fi->sampleType == stFloat) {
+                normalize_detail_plane<float>(src, dst, plane, d, eps,
+                                              max_gain, vsapi);
+            } else if (fi->bytesPerSample == 1) {
+                normalize_detail_plane<uint8_t>(src, dst, plane, d, eps,
+                                                max_gain, vsapi);
+            } else {
+                normalize_detail_plane<uint16_t>(src, dst, plane, d, eps,
+                                                 max_gain, vsapi);
+            }
+        }
+
+        vsapi->freeFrame(src);
+        return dst;
+    }
+    return nullptr;
+}
+
+// Temporal detail: the frame minus the {1,4,6,4,1} blur of frames
+// n + k*step, k in [-2, 2], each neighbour motion compensated per block.
+// Vectors are read from frame n of the vector clip (or of the clip itself):
+// MVBlockSize is the block size in luma pixels, and MVForward<d> and
+// MVBackward<d> hold integer (dx, dy) pairs in luma pixels per block in
+// raster order, pointing from the block in frame n to its match in frame
+// n + d or n - d. A missing array means no motion.
+struct TemporalData {
+    VSNode* node;
+    VSNode* vectors;
+    VSVideoInfo vi;
+    int step;
+};
+
+// Frame k taps away from n, reflected at the clip ends.
+int temporal_tap(int n, int k, int step, int num_frames) noexcept {
+    return std::clamp(mirror_boundary(n + (k * step), num_frames), 0,
+                      num_frames - 1);
+}
+
+// Adds weight * ref over a block displaced by (dx, dy), clamping the
+// fetch to the plane. Rows that stay inside the plane horizontally are
+// read contiguously, which vectorizes.
+template <typename T>
+void accumulate_block(const T* VS_RESTRICT ref, ptrdiff_t stride, int width,
+                      int height, int x0, int y0, int block_w, int block_h,
+                      int dx, int dy, float weight, float* VS_RESTRICT acc) {
+    const int x1 = std::min(x0 + block_w, width);
+    const int y1 = std::min(y0 + block_h, height);
+    const bool inside = x0 + dx >= 0 && x1 + dx <= width;
+
+    for (int y = y0; y < y1; ++y) {
+        const T* VS_RESTRICT ref_row =
+            ref + (std::clamp(y + dy, 0, height - 1) * stride);
+        float* VS_RESTRICT acc_row = acc + (y * static_cast<ptrdiff_t>(width));
+        if (inside) {
+            const T* VS_RESTRICT fetch = ref_row + dx;
+            for (int x = x0; x < x1; ++x) {
+                acc_row[x] += weight * static_cast<float>(fetch[x]);
+            }
+        } else {
+            for (int x = x0; x < x1; ++x) {
+                acc_row[x] += weight * static_cast<float>(
+                                           ref_row[std::clamp(x + dx, 0,
+                                                              width - 1)]);
+            }
+        }
+    }
+}
+
+template <typename T>
+void temporal_plane(const std::array<const VSFrame*, 5>& taps,
+                    const std::array<const int64_t*, 5>& vectors,
+                    int block_size, VSFrame* dst, int plane,
+                    const VSVideoFormat* fi, const VSAPI* vsapi) {
+    const VSFrame* src = taps[2];
+    const int width = vsapi->getFrameWidth(src, plane);
+    const int height = vsapi->getFrameHeight(src, plane);
+    const int ssw = plane != 0 ? fi->subSamplingW : 0;
+    const int ssh = plane != 0 ? fi->subSamplingH : 0;
+    const int block_w = block_size >> ssw;
+    const int block_h = block_size >> ssh;
+    const int blocks_x = (vsapi->getFrameWidth(src, 0) + block_size - 1) /
+                         block_size;
+    const int blocks_y = (vsapi->getFrameHeight(src, 0) + block_size - 1) /
+                         block_size;
+
+    std::vector<float> acc(static_cast<std::size_t>(width) * height, 0.0F);
+
+    for (int k = 0; k < 5; ++k) {
+        const ptrdiff_t stride = vsapi->getStride(taps[k], plane) / sizeof(T);
+        const T* refp =
+            reinterpret_cast<const T*>(vsapi->getReadPtr(taps[k], plane));
+        const auto weight = static_cast<float>(KERNEL.at(k));
+
+        for (int by = 0; by < blocks_y; ++by) {
+            for (int bx = 0; bx < blocks_x; ++bx) {
+                int dx = 0;
+                int dy = 0;
+                if (vectors[k] != nullptr) {
+                    const int64_t* v =
+                        vectors[k] + (2 * ((by * blocks_x) + bx));
+                    dx = static_cast<int>(v[0]) >> ssw;
+                    dy = static_cast<int>(v[1]) >> ssh;
+                }
+                accumulate_block(refp, stride, width, height, bx * block_w,
+                                 by * block_h, block_w, block_h, dx, dy,
+                                 weight, acc.data());
+            }
+        }
+    }
+
+    const ptrdiff_t src_stride = vsapi->getStride(src, plane) / sizeof(T);
+    const ptrdiff_t dst_stride = vsapi->getStride(dst, plane) / sizeof(T);
+    const T* srcp = reinterpret_cast<const T*>(vsapi->getReadPtr(src, plane));
+    T* dstp = reinterpret_cast<T*>(vsapi->getWritePtr(dst, plane));
+    const float neutral = get_neutral<T>(fi);
+    const float max_val = get_max<T>(fi);
+
+    for (int y = 0; y < height; ++y) {
+        const T* VS_RESTRICT src_row = srcp + (y * src_stride);
+        const float* VS_RESTRICT acc_row =
+            acc.data() + (y * static_cast<ptrdiff_t>(width));
+        T* VS_RESTRICT dst_row = dstp + (y * dst_stride);
+        for (int x = 0; x < width; ++x) {
+            float detail =
+                static_cast<float>(src_row[x]) - (acc_row[x] / 16.0F) + neutral;
+            if constexpr (std::integral<T>) {
+                dst_row[x] = static_cast<T>(
+                    std::clamp(std::round(detail), 0.0F, max_val));
+            } else {
+                dst_row[x] = detail;
+            }
+        }
+    }
+}
+
+const VSFrame* VS_CC TemporalGetFrame(int n, int activationReason,
+                                      void* instanceData,
+                                      [[maybe_unused]] void** frameData,
+                                      VSFrameContext* frameCtx, VSCore* core,
+                                      const VSAPI* vsapi) {
+    auto* d = static_cast<TemporalData*>(instanceData);
+    const int num_frames = d->vi.numFrames;
+
+    if (activationReason == arInitial) {
+        for (int k = -2; k <= 2; ++k) {
+            vsapi->requestFrameFilter(temporal_tap(n, k, d->step, num_frames),
+                                      d->node, frameCtx);
+        }
+        if (d->vectors != nullptr) {
+            vsapi->requestFrameFilter(n, d->vectors, frameCtx);
+        }
+    } else if (activationReason == arAllFramesReady) {
+        std::array<const VSFrame*, 5> taps{};
+        for (int k = -2; k <= 2; ++k) {
+            taps[k + 2] = vsapi->getFrameFilter(
+                temporal_tap(n, k, d->step, num_frames), d->node, frameCtx);
+        }
+        const VSFrame* vector_frame =
+            d->vectors != nullptr
+                ? vsapi->getFrameFilter(n, d->vectors, frameCtx)
+                : vsapi->addFrameRef(taps[2]);
+        const VSMap* props = vsapi->getFramePropertiesRO(vector_frame);
+        const VSFrame* src = taps[2];
+        const VSVideoFormat* fi = vsapi->getVideoFrameFormat(src);
+        const int width = vsapi->getFrameWidth(src, 0);
+        const int height = vsapi->getFrameHeight(src, 0);
+
+        auto release = [&] {
+            for (const VSFrame* tap : taps) {
+                vsapi->freeFrame(tap);
+            }
+            vsapi->freeFrame(vector_frame);
+        };
+
+        int err = 0;
+        int block_size = vsh::int64ToIntS(
+            vsapi->mapGetInt(props, "MVBlockSize", 0, &err));
+        if (err != 0) {
+            block_size = std::max(width, height);
+        }
+        if (block_size < 1 ||
+            block_size % (1 << std::max(fi->subSamplingW,
+                                        fi->subSamplingH)) != 0) {
+            vsapi->setFilterError("ExtractTemporal: MVBlockSize must be a "
+                                  "positive multiple of the chroma "
+                                  "subsampling",
+                                  frameCtx);
+            release();
+            return nullptr;
+        }
+
+        // Pick each tap's vectors by its actual offset, so taps reflected
+        // at the clip ends use the opposite direction.
+        const int blocks = ((width + block_size - 1) / block_size) *
+                           ((height + block_size - 1) / block_size);
+        std::array<const int64_t*, 5> vectors{};
+        for (int k = -2; k <= 2; ++k) {
+            const int offset = temporal_tap(n, k, d->step, num_frames) - n;
+            if (offset == 0) {
+                continue;
+            }
+            const std::string key =
+                (offset > 0 ? "MVForward" : "MVBackward") +
+                std::to_string(std::abs(offset));
+            if (vsapi->mapNumElements(props, key.c_str()) < 0) {
+                continue;
+            }
+            if (vsapi->mapNumElements(props, key.c_str()) != 2 * blocks) {
+                vsapi->setFilterError(
+                    ("ExtractTemporal: " + key + " must hold one (dx, dy) "
+                     "pair per block")
+                        .c_str(),
+                    frameCtx);
+                release();
+                return nullptr;
+            }
+            vectors[k + 2] =
+                vsapi->mapGetIntArray(props, key.c_str(), nullptr);
+        }
+
+        VSFrame* dst = vsapi->newVideoFrame(fi, width, height, src, core);
+
+        for (int plane = 0; plane < fi->numPlanes; plane++) {
+            if (fi->sampleType == stInteger) {
+                switch (fi->bytesPerSample) {
+                case 1:
+                    temporal_plane<uint8_t>(taps, vectors, block_size, dst,
+                                            plane, fi, vsapi);
+                    break;
+                case 2:
+                    temporal_plane<uint16_t>(taps, vectors, block_size, dst,
+                                             plane, fi, vsapi);
+                    break;
+                }
+            } else if (fi->sampleType == stFloat) {
+                switch (fi->bytesPerSample) {
+                case 4:
+                    temporal_plane<float>(taps, vectors, block_size, dst,
+                                          plane, fi, vsapi);
+                    break;
+                }
+            }
+        }
+
+        release();
+        return dst;
+    }
+    return nullptr;
+}
+
+void VS_CC TemporalFree(void* instanceData, [[maybe_unused]] VSCore* core,
+                        const VSAPI* vsapi) {
+    auto d =
+        std::unique_ptr<TemporalData>(static_cast<TemporalData*>(instanceData));
+    vsapi->freeNode(d->node);
+    vsapi->freeNode(d->vectors);
+}
+
+void VS_CC TemporalCreate(const VSMap* in, VSMap* out,
+                          [[maybe_unused]] void* userData, VSCore* core,
+                          const VSAPI* vsapi) {
+    auto d = std::make_unique<TemporalData>();
+    int err = 0;
+
+    d->node = vsapi->mapGetNode(in, "clip", 0, 0);
+    d->vectors = vsapi->mapGetNode(in, "vectors", 0, &err);
+    d->vi = *vsapi->getVideoInfo(d->node);
+
+    auto fail = [&](const char* message) {
+        vsapi->mapSetError(out, message);
+        vsapi->freeNode(d->node);
+        vsapi->freeNode(d->vectors);
+    };
+
+    int radius = vsh::int64ToIntS(vsapi->mapGetInt(in, "radius", 0, &err));
+    if (err != 0) {
+        radius = 1;
+    }
+
+    if (radius < 1 || radius > 16) {
+        fail("ExtractTemporal: radius must be between 1 and 16");
+        return;
+    }
+    d->step = 1 << (radius - 1);
+
+    if (!vsh::isConstantVideoFormat(&d->vi) ||
+        !is_supported_format(d->vi.format)) {
+        fail("ExtractTemporal: only constant 8-16 bit integer or 32 bit "
+             "float input are accepted");
+        return;
+    }
+
+    if (d->vectors != nullptr &&
+        vsapi->getVideoInfo(d->vectors)->numFrames != d->vi.numFrames) {
+        fail("ExtractTemporal: vectors must have as many frames as clip");
+        return;
+    }
+
+    std::vector<VSFilterDependency> deps = {{d->node, rpGeneral}};
+    if (d->vectors != nullptr) {
+        deps.push_back({d->vectors, rpStrictSpatial});
+    }
+    auto* data = d.release();
+    vsapi->createVideoFilter(out, "ExtractTemporal", &data->vi,
+                             TemporalGetFrame, TemporalFree, fmParallel,
+                             deps.data(), static_cast<int>(deps.size()), data,
+                             core);
+}
+
+// Scratch of local_min_max, kept across the strips of a plane.
+template <typename T>
+struct MinMaxScratch {
+    // Vertical extremes of the strip, rows padded by radius columns.
+    std::vector<T> row_lo;
+    std::vector<T> row_hi;
+    // Suffix extremes of one block and the running prefix extremes.
+    std::vector<T> suffix;
+    std::vector<T> prefix;
+};
+
+// Running minimum and maximum over windows of 2*radius+1 rows: row j of lo
+// and hi gets the extremes of rows row(j) to row(j + 2*radius), for n rows
+// of len entries. Van Herk/Gil-Werman: each block of window rows is scanned
+// backwards once for its suffix extremes, the next block forwards for its
+// prefix extremes, and every window is one suffix and one prefix apart. So
+// an entry costs three min and three max whatever the radius, and all loops
+// run along rows, where they vectorize.
+template <typename T, typename Row>
+void min_max_rows(Row row, int n, int radius, int len, T* lo, T* hi,
+                  ptrdiff_t out_stride, MinMaxScratch<T>& scratch) {
+    if (radius == 1) {
+        for (int j = 0; j < n; ++j) {
+            const T* VS_RESTRICT a = row(j);
+            const T* VS_RESTRICT b = row(j + 1);
+            const T* VS_RESTRICT c = row(j + 2);
+            T* VS_RESTRICT l = lo + (j * out_stride);
+            T* VS_RESTRICT h = hi + (j * out_stride);
+            for (int x = 0; x < len; ++x) {
+                l[x] = std::min(std::min(a[x], b[x]), c[x]);
+                h[x] = std::max(std::max(a[x], b[x]), c[x]);
+            }
+        }
+        return;
+    }
+
+    const int window = (2 * radius) + 1;
+    const int last = window - 1;
+    const auto block = static_cast<std::size_t>(window) * len;
+    scratch.suffix.resize(2 * block);
+    scratch.prefix.resize(2 * static_cast<std::size_t>(len));
+    T* VS_RESTRICT suf_lo = scratch.suffix.data();
+    T* VS_RESTRICT suf_hi = suf_lo + block;
+    T* VS_RESTRICT pre_lo = scratch.prefix.data();
+    T* VS_RESTRICT pre_hi = pre_lo + len;
+
+    for (int begin = 0; begin < n; begin += window) {
+        std::copy_n(row(begin + last), len, suf_lo + (last * len));
+        std::copy_n(row(begin + last), len, suf_hi + (last * len));
+        for (int k = last - 1; k >= 0; --k) {
+            const T* VS_RESTRICT src = row(begin + k);
+            const T* VS_RESTRICT next_lo = suf_lo + ((k + 1) * len);
+            const T* VS_RESTRICT next_hi = suf_hi + ((k + 1) * len);
+            T* VS_RESTRICT l = suf_lo + (k * len);
+            T* VS_RESTRICT h = suf_hi + (k * len);
+            for (int x = 0; x < len; ++x) {
+                l[x] = std::min(next_lo[x], src[x]);
+                h[x] = std::max(next_hi[x], src[x]);
+            }
+        }
+
+        // The window of the first row is the block itself.
+        std::copy_n(suf_lo, len, lo + (begin * out_stride));
+        std::copy_n(suf_hi, len, hi + (begin * out_stride));
+
+        const int end = std::min(begin + window, n);
+        for (int j = begin + 1; j < end; ++j) {
+            const T* VS_RESTRICT src = row(j + last);
+            if (j == begin + 1) {
+                std::copy_n(src, len, pre_lo);
+                std::copy_n(src, len, pre_hi);
+            } else {
+                for (int x = 0; x < len; ++x) {
+                    pre_lo[x] = std::min(pre_lo[x], src[x]);
+                    pre_hi[x] = std::max(pre_hi[x], src[x]);
+                }
+            }
+            const T* VS_RESTRICT s_lo = suf_lo + ((j - begin) * len);
+            const T* VS_RESTRICT s_hi = suf_hi + ((j - begin) * len);
+            T* VS_RESTRICT l = lo + (j * out_stride);
+            T* VS_RESTRICT h = hi + (j * out_stride);
+            for (int x = 0; x < len; ++x) {
+                l[x] = std::min(s_lo[x], pre_lo[x]);
+                h[x] = std::max(s_hi[x], pre_hi[x]);
+            }
+        }
+    }
+}
+
+// The same extremes along one row padded by radius entries each side:
+// entry x of dst_lo and dst_hi gets the extremes of entries x to
+// x + 2*radius of lo and hi, which are overwritten. Along a row the scans of
+// min_max_rows would be serial, so extremes of spans of 2, 4, 8, ...
+// entries are built in place until two of them cover the window instead.
+// That is log2(window) + 1 passes, all of which vectorize.
+template <typename T>
+void min_max_columns(T* VS_RESTRICT lo, T* VS_RESTRICT hi, int n, int radius,
+                     T* VS_RESTRICT dst_lo, T* VS_RESTRICT dst_hi) {
+    const int window = (2 * radius) + 1;
+    int span = 1;
+    for (int len = n + window - 1; 2 * span <= window; span *= 2) {
+        len -= span;
+        for (int x = 0; x < len; ++x) {
+            lo[x] = std::min(lo[x], lo[x + span]);
+            hi[x] = std::max(hi[x], hi[x + span]);
+        }
+    }
+
+    const int offset = window - span;
+    for (int x = 0; x < n; ++x) {
+        dst_lo[x] = std::min(lo[x], lo[x + offset]);
+        dst_hi[x] = std::max(hi[x], hi[x + offset]);
+    }
+}
+
+// Local minimum and maximum of ref over (2*radius+1)^2 windows truncated at
+// the plane edges, for rows [y_begin, y_end) and columns [x_begin, x_end).
+// lo and hi are packed with a stride of x_end - x_begin. Edge rows and
+// columns are repeated instead of truncating the windows, which gives the
+// same extremes. The vertical pass goes first, so the halo rows of a strip
+// only cost vectorized row operations.
+template <typename T>
+void local_min_max(const T* ref, ptrdiff_t stride, int width, int height,
+                   int x_begin, int x_end, int y_begin, int y_end, int radius,
+                   T* lo, T* hi, MinMaxScratch<T>& scratch) {
+    const int out_width = x_end - x_begin;
+    const int out_height = y_end - y_begin;
+    const int col_begin = std::max(x_begin - radius, 0);
+    const int col_end = std::min(x_end + radius, width);
+    const int padded = out_width + (2 * radius);
+    const int left = col_begin - (x_begin - radius);
+    const int right = left + (col_end - col_begin);
+
+    const auto size = static_cast<std::size_t>(out_height) * padded;
+    scratch.row_lo.resize(size);
+    scratch.row_hi.resize(size);
+    T* row_lo = scratch.row_lo.data();
+    T* row_hi = scratch.row_hi.data();
+
+    auto row = [&](int i) {
+        const int y = std::clamp(y_begin - radius + i, 0, height - 1);
+        return ref + (y * stride) + col_begin;
+    };
+    min_max_rows<T>(row, out_height, radius, col_end - col_begin,
+                    row_lo + left, row_hi + left, padded, scratch);
+
+    for (int j = 0; j < out_height; ++j) {
+        T* l = row_lo + (j * static_cast<ptrdiff_t>(padded));
+        T* h = row_hi + (j * static_cast<ptrdiff_t>(padded));
+        std::fill(l, l + left, l[left]);
+        std::fill(h, h + left, h[left]);
+        std::fill(l + right, l + padded, l[right - 1]);
+        std::fill(h + right, h + padded, h[right - 1]);
+        min_max_columns(l, h, out_width, radius, lo + (j * out_width),
+                        hi + (j * out_width));
+    }
+}
+
+// Loads one row of detail weights in [0, 1]. A mask plane that is larger
+// than the output plane (luma mask on subsampled chroma) is box-averaged
+// over each 2^ssw x 2^ssh block.
+template <typename T>
+void load_mask_row(const T* VS_RESTRICT maskp, ptrdiff_t mask_stride,
+                   float* VS_RESTRICT weights, int width, int ssw, int ssh,
+                   float max_val) {
+    const int block_w = 1 << ssw;
+    const int block_h = 1 << ssh;
+    const float scale =
+        1.0F / (max_val * static_cast<float>(block_w * block_h));
+
+    for (int x = 0; x < width; ++x) {
+        float sum = 0.0F;
+        for (int j = 0; j < block_h; ++j) {
+            for (int i = 0; i < block_w; ++i) {
+                sum += static_cast<float>(
+                    maskp[(j * mask_stride) + (x << ssw) + i]);
+            }
+        }
+        weights[x] = std::clamp(sum * scale, 0.0F, 1.0F);
+    }
+}
+
+// A plane of weights, read a row at a time through load_mask_row. A full
+// resolution weight plane is box-averaged down to a subsampled output plane.
+template <typename T>
+struct WeightPlane {
+    const T* ptr;
+    ptrdiff_t stride;
+    int ssw;
+    int ssh;
+};
+
+template <typename T>
+WeightPlane<T> get_weight_plane(const VSFrame* frame, int weight_plane,
+                                int plane, int left, const VSVideoFormat* fi,
+                                const VSAPI* vsapi) {
+    const VSVideoFormat* wfi = vsapi->getVideoFrameFormat(frame);
+    const bool full_res = weight_plane == 0 || (wfi->subSamplingW == 0 &&
+                                                wfi->subSamplingH == 0);
+    const int ssw = full_res && plane != 0 ? fi->subSamplingW : 0;
+    const int ssh = full_res && plane != 0 ? fi->subSamplingH : 0;
+    return {reinterpret_cast<const T*>(
+                vsapi->getReadPtr(frame, weight_plane)) +
+                (left << ssw),
+            vsapi->getStride(frame, weight_plane) /
+                static_cast<ptrdiff_t>(sizeof(T)),
+            ssw, ssh};
+}
+
+// Plane of a mask or weight clip used for an output plane: the first one for
+// Gray clips or with first_plane, otherwise the matching one.
+int map_plane(const VSFrame* frame, int plane, bool first_plane,
+              const VSAPI* vsapi) {
+    return first_plane || vsapi->getVideoFrameFormat(frame)->numPlanes == 1
+               ? 0
+               : plane;
+}
+
+// Rows of local min/max computed at a time for the overshoot limit, at
+// least eight times the radius so that the halo rows of a strip add at most
+// a quarter to its vertical pass.
+constexpr int OVERSHOOT_STRIP = 64;
+
+constexpr int overshoot_strip(int radius) noexcept {
+    return std::max(OVERSHOOT_STRIP, 8 * radius);
+}
+
+template <typename T, typename D>
+void replace_plane(const ReplaceFrames& frames, VSFrame* dst, int plane,
+                   const ReplaceData* rd, const VSVideoFormat* fi,
+                   const VSAPI* vsapi) {
+    const VSFrame* base = frames.base;
+    const std::vector<const VSFrame*>& details = frames.details;
+    const std::vector<const VSFrame*>& weights = frames.weights;
+    const VSFrame* mask = frames.mask;
+
+    const int width = vsapi->getFrameWidth(dst, plane);
+    const int height = vsapi->getFrameHeight(dst, plane);
+    const ptrdiff_t stride = vsapi->getStride(dst, plane) / sizeof(T);
+    const ptrdiff_t detail_stride =
+        vsapi->getStride(details.front(), plane) / sizeof(D);
+
+    // In a packed pyramid layer k starts k plane heights down, and the
+    // base follows the details.
+    auto layer_offset = [&](std::size_t layer, ptrdiff_t layer_stride) {
+        return rd->packed
+                   ? static_cast<ptrdiff_t>(layer) * height * layer_stride
+                   : 0;
+    };
+
+    const T* basep =
+        reinterpret_cast<const T*>(vsapi->getReadPtr(base, plane)) +
+        layer_offset(details.size(), stride);
+    std::vector<const D*> detailps;
+    detailps.reserve(details.size());
+    for (const VSFrame* detail : details) {
+        detailps.push_back(
+            reinterpret_cast<const D*>(vsapi->getReadPtr(detail, plane)) +
+            layer_offset(detailps.size(), detail_stride));
+    }
+    T* VS_RESTRICT dstp = reinterpret_cast<T*>(vsapi->getWritePtr(dst, plane));
+
+    const auto neutral = static_cast<D>(
+        get_neutral<D>(vsapi->getVideoFrameFormat(details.front())));
+    const float max_val = get_max<T>(fi);
+
+    // Outside the ROI the base passes through unchanged.
+    const Rect roi = plane_rect(rd->roi, *fi, plane, width, height);
+    for_each_outside(width, height, roi, [&](int y, int x_begin, int x_end) {
+        std::memcpy(dstp + (y * stride) + x_begin,
+                    basep + (y * stride) + x_begin,
+                    (x_end - x_begin) * sizeof(T));
+    });
+
+    const int roi_width = roi.right - roi.left;
+    basep += (roi.top * stride) + roi.left;
+    dstp += (roi.top * stride) + roi.left;
+
+    // Level k is weighted by its own clip, or by plane k of a single clip.
+    std::vector<WeightPlane<T>> level_weights;
+    for (size_t k = 0; !weights.empty() && k < details.size(); ++k) {
+        const VSFrame* weight =
+            rd->weight_planes ? weights.front() : weights[k];
+        const int weight_plane =
+            rd->weight_planes
+                ? static_cast<int>(k)
+                : map_plane(weight, plane, rd->first_plane, vsapi);
+        level_weights.push_back(get_weight_plane<T>(
+            weight, weight_plane, plane, roi.left, fi, vsapi));
+    }
+
+    WeightPlane<T> mask_weights{};
+    if (mask != nullptr) {
+        mask_weights = get_weight_plane<T>(
+            mask, map_plane(mask, plane, rd->first_plane, vsapi), plane,
+            roi.left, fi, vsapi);
+    }
+
+    auto load_weights = [&](const WeightPlane<T>& wp, int y, float* row) {
+        load_mask_row<T>(wp.ptr + ((y << wp.ssh) * wp.stride), wp.stride, row,
+                         roi_width, wp.ssw, wp.ssh, max_val);
+        return row;
+    };
+
+    std::vector<float> sum_buffer(roi_width);
+    std::vector<float> weight_buffer(roi_width);
+    float* VS_RESTRICT sum = sum_buffer.data();
+
+    const float gain = frames.gain;
+    const T* refp = nullptr;
+    ptrdiff_t ref_stride = 0;
+    float margin = 0.0F;
+    std::vector<T> lo_buffer;
+    std::vector<T> hi_buffer;
+    int strip = OVERSHOOT_STRIP;
+    MinMaxScratch<T> min_max;
+    if (rd->limit_overshoot) {
+        const VSFrame* ref =
+            frames.reference != nullptr ? frames.reference : base;
+        ref_stride = vsapi->getStride(ref, plane) / sizeof(T);
+        refp = reinterpret_cast<const T*>(vsapi->getReadPtr(ref, plane)) +
+               (ref == base ? layer_offset(details.size(), ref_stride) : 0);
+        strip = overshoot_strip(rd->overshoot_radius);
+        lo_buffer.resize(static_cast<std::size_t>(strip) * roi_width);
+        margin = frames.overshoot * max_val;
+        hi_buffer.resize(lo_buffer.size());
+    }
+
+    // Rows are written in place. Unlike ExtractFrequency, streaming them out
+    // of a row buffer measured slower here: the extra copy costs more than
+    // the cache it keeps free.
+    for (int y = roi.top; y < roi.bottom; ++y) {
+        T* VS_RESTRICT out = dstp;
+
+        const int strip_row = (y - roi.top) % strip;
+        if (refp != nullptr && strip_row == 0) {
+            local_min_max<T>(refp, ref_stride, width, height, roi.left,
+                             roi.right, y,
+                             std::min(y + strip, roi.bottom),
+                             rd->overshoot_radius, lo_buffer.data(),
+                             hi_buffer.data(), min_max);
+        }
+
+        std::fill_n(sum, roi_width, 0.0F);
+        for (size_t k = 0; k < detailps.size(); ++k) {
+            const D* VS_RESTRICT detailp =
+                detailps[k] + (y * detail_stride) + roi.left;
+            if (level_weights.empty()) {
+                for (int x = 0; x < roi_width; ++x) {
+                    sum[x] += centered(detailp[x], neutral);
+                }
+            } else {
+                const float* VS_RESTRICT w =
+                    load_weights(level_weights[k], y, weight_buffer.data());
+                for (int x = 0; x < roi_width; ++x) {
+                    sum[x] += centered(detailp[x], neutral) * w[x];
+                }
+            }
+        }
+
+        const float* VS_RESTRICT w = nullptr;
+        if (mask != nullptr) {
+            w = load_weights(mask_weights, y, weight_buffer.data());
+        }
+
+        for (int x = 0; x < roi_width; ++x) {
+            auto b = static_cast<float>(basep[x]);
+
+            float diff = sum[x] * gain;
+            if (w != nullptr) {
+                diff *= w[x];
+            }
+            sum[x] = rd->subtract ? b - diff : b + diff;
+        }
+
+        // Apart from the rounding below, so that it vectorizes; lo <= hi, so
+        // min and max clamp without branches.
+        if (refp != nullptr) {
+            const std::size_t row = strip_row * roi_width;
+            const T* VS_RESTRICT lo = lo_buffer.data() + row;
+            const T* VS_RESTRICT hi = hi_buffer.data() + row;
+            for (int x = 0; x < roi_width; ++x) {
+                sum[x] = std::min(
+                    std::max(sum[x], static_cast<float>(lo[x]) - margin),
+                    static_cast<float>(hi[x]) + margin);
+            }
+        }
+
+        for (int x = 0; x < roi_width; ++x) {
+            if constexpr (std::integral<T>) {
+                out[x] = static_cast<T>(
+                    std::clamp(std::round(sum[x]), 0.0F, max_val));
+            } else {
+                out[x] = static_cast<T>(sum[x]);
+            }
+        }
+
+        basep += stride;
+        dstp += stride;
+    }
+}
+
+template <typename T>
+void ProcessReplacePlane(const ReplaceFrames& frames, VSFrame* dst, int plane,
+                         const ReplaceData* rd, const VSVideoFormat* fi,
+                         const VSAPI* vsapi) {
+    if constexpr (std::integral<T>) {
+        switch (vsapi->getVideoFrameFormat(frames.details.front())
+                    ->bytesPerSample) {
+        case 1:
+            replace_plane<T, uint8_t>(frames, dst, plane, rd, fi, vsapi);
+            break;
+        case 2:
+            replace_plane<T, uint16_t>(frames, dst, plane, rd, fi, vsapi);
+            break;
+        case 4:
+            replace_plane<T, uint32_t>(frames, dst, plane, rd, fi, vsapi);
+            break;
+        }
+    } else {
+        replace_plane<T, T>(frames, dst, plane, rd, fi, vsapi);
+    }
+}
+
+void release_replace_frames(const ReplaceFrames& frames, const VSAPI* vsapi) {
+    vsapi->freeFrame(frames.base);
+    for (const VSFrame* detail : frames.details) {
+        vsapi->freeFrame(detail);
+    }
+    for (const VSFrame* weight : frames.weights) {
+        vsapi->freeFrame(weight);
+    }
+    vsapi->freeFrame(frames.mask);
+    vsapi->freeFrame(frames.reference);
+}
+
+const VSFrame* VS_CC ReplaceGetFrame(int n, int activationReason,
+                                     void* instanceData,
+                                     [[maybe_unused]] void** frameData,
+                                     VSFrameContext* frameCtx, VSCore* core,
+                                     const VSAPI* vsapi) {
+    auto* d = static_cast<ReplaceData*>(instanceData);
+
+    if (activationReason == arInitial) {
+        vsapi->requestFrameFilter(n, d->base, frameCtx);
+        for (VSNode* detail : d->details) {
+            if (!d->packed) {
+                vsapi->requestFrameFilter(n, detail, frameCtx);
+            }
+        }
+        for (VSNode* weight : d->weights) {
+            vsapi->requestFrameFilter(n, weight, frameCtx);
+        }
+        if (d->mask != nullptr) {
+            vsapi->requestFrameFilter(n, d->mask, frameCtx);
+        }
+        if (d->reference != nullptr) {
+            vsapi->requestFrameFilter(n, d->reference, frameCtx);
+        }
+    } else if (activationReason == arAllFramesReady) {
+        ReplaceFrames frames{};
+        frames.base = vsapi->getFrameFilter(n, d->base, frameCtx);
+        frames.details.reserve(d->details.size());
+        for (VSNode* detail : d->details) {
+            frames.details.push_back(
+                d->packed ? vsapi->addFrameRef(frames.base)
+                          : vsapi->getFrameFilter(n, detail, frameCtx));
+        }
+        frames.weights.reserve(d->weights.size());
+        for (VSNode* weight : d->weights) {
+            frames.weights.push_back(
+                vsapi->getFrameFilter(n, weight, frameCtx));
+        }
+        if (d->mask != nullptr) {
+            frames.mask = vsapi->getFrameFilter(n, d->mask, frameCtx);
+        }
+        if (d->reference != nullptr) {
+            frames.reference = vsapi->getFrameFilter(n, d->reference, frameCtx);
+        }
+        const VSFrame* base = frames.base;
+        const VSVideoFormat* fi = vsapi->getVideoFrameFormat(base);
+
+        const auto levels = static_cast<int>(d->details.size());
+        if (d->packed && !packed_levels_match(base, levels, vsapi)) {
+            vsapi->setFilterError(
+                packed_levels_error("Recompose", n, levels).c_str(),
+                frameCtx);
+            release_replace_frames(frames, vsapi);
+            return nullptr;
+        }
+
+        frames.gain = frame_param(base, d->prop_gain, d->gain, vsapi);
+        frames.overshoot =
+            frame_param(base, d->prop_overshoot, d->overshoot, vsapi);
+        if (frames.overshoot < 0.0F) {
+            vsapi->setFilterError(
+                ("frame property " + d->prop_overshoot + " must be >= 0")
+                    .c_str(),
+                frameCtx);
+            release_replace_frames(frames, vsapi);
+            return nullptr;
+        }
+
+        VSFrame* dst = vsapi->newVideoFrame(fi, d->vi.width, d->vi.height,
+                                            base, core);
+        if (d->packed) {
+            VSMap* props = vsapi->getFramePropertiesRW(dst);
+            vsapi->mapDeleteKey(props, PACKED_LEVELS_PROP);
+            vsapi->mapDeleteKey(props, PACKED_OFFSETS_PROP);
+        }
+
+        for (int plane = 0; plane < fi->numPlanes; plane++) {
+            if (fi->sampleType == stInteger) {
+                switch (fi->bytesPerSample) {
+                case 1:
+                    ProcessReplacePlane<uint8_t>(frames, dst, plane, d, fi,
+                                                 vsapi);
+                    break;
+                case 2:
+                    ProcessReplacePlane<uint16_t>(frames, dst, plane, d, fi,
+                                                  vsapi);
+                    break;
+                case 4:
+                    ProcessReplacePlane<uint32_t>(frames, dst, plane, d, fi,
+                                                  vsapi);
+                    break;
+                }
+            } else if (fi->sampleType == stFloat) {
+                switch (fi->bytesPerSample) {
+                case 4:
+                    ProcessReplacePlane<float>(frames, dst, plane, d, fi,
+                                               vsapi);
+                    break;
+                }
+            }
+        }
+
+        release_replace_frames(frames, vsapi);
+        return dst;
+    }
+    return nullptr;
+}
+
+void VS_CC ReplaceFree(void* instanceData, [[maybe_unused]] VSCore* core,
+                       const VSAPI* vsapi) {
+    auto d =
+        std::unique_ptr<ReplaceData>(static_cast<ReplaceData*>(instanceData));
+    vsapi->freeNode(d->base);
+    for (VSNode* detail : d->details) {
+        vsapi->freeNode(detail);
+    }
+    for (VSNode* weight : d->weights) {
+        vsapi->freeNode(weight);
+    }
+    vsapi->freeNode(d->mask);
+    vsapi->freeNode(d->reference);
+}
+
+// Reads the overshoot limiting and gain arguments shared by
+// ReplaceFrequency and Recompose. The limit is off unless overshoot or
+// prop_overshoot is given.
+void read_overshoot(const VSMap* in, ReplaceData* d, const VSAPI* vsapi) {
+    int err = 0;
+    d->overshoot = vsapi->mapGetFloatSaturated(in, "overshoot", 0, &err);
+    d->limit_overshoot = err == 0;
+    if (err != 0) {
+        d->overshoot = 0.0F;
+    }
+
+    d->overshoot_radius =
+        vsh::int64ToIntS(vsapi->mapGetInt(in, "overshoot_radius", 0, &err));
+    if (err != 0) {
+        d->overshoot_radius = 1;
+    }
+
+    d->reference = vsapi->mapGetNode(in, "reference", 0, &err);
+
+    d->gain = vsapi->mapGetFloatSaturated(in, "gain", 0, &err);
+    if (err != 0) {
+        d->gain = 1.0F;
+    }
+    d->prop_gain = read_prop_name(in, "prop_gain", vsapi);
+    d->prop_overshoot = read_prop_name(in, "prop_overshoot", vsapi);
+    // A per-frame overshoot turns the limit on.
+    d->limit_overshoot = d->limit_overshoot || !d->prop_overshoot.empty();
+}
+
+// Validates the inputs shared by ReplaceFrequency and Recompose and creates
+// the filter, or sets an error and releases the nodes.
+void create_replace(std::unique_ptr<ReplaceData> d, const char* name,
+                    VSMap* out, VSCore* core, const VSAPI* vsapi) {
+    auto fail = [&](const char* message) {
+        vsapi->mapSetError(out, (std::string(name) + ": " + message).c_str());
+        ReplaceFree(d.release(), core, vsapi);
+    };
+
+    if (!vsh::isConstantVideoFormat(&d->vi) ||
+        !is_supported_format(d->vi.format)) {
+        fail("only constant 8-16 bit integer or 32 bit float input are "
+             "accepted");
+        return;
+    }
+
+    if (!is_valid_roi(d->roi, d->vi)) {
+        fail("left, top, width and height must give a non-empty rectangle "
+             "inside the frame");
+        return;
+    }
+
+    // A detail may also be in the wider format written by lossless mode.
+    const VSVideoFormat detail_format =
+        vsapi->getVideoInfo(d->details.front())->format;
+    VSVideoFormat lossless_format{};
+    if (d->vi.format.sampleType == stInteger) {
+        vsapi->queryVideoFormat(
+            &lossless_format, d->vi.format.colorFamily, stInteger,
+            lossless_detail_bits(d->vi.format.bitsPerSample),
+            d->vi.format.subSamplingW, d->vi.format.subSamplingH, core);
+    }
+
+    // The layers of a packed pyramid are a fraction of the clip's height.
+    const int layers = d->packed ? static_cast<int>(d->details.size()) + 1 : 1;
+    for (VSNode* detail : d->details) {
+        const VSVideoInfo* vi_detail = vsapi->getVideoInfo(detail);
+        if (!vsh::isSameVideoFormat(&vi_detail->format, &detail_format) ||
+            (!vsh::isSameVideoFormat(&d->vi.format, &detail_format) &&
+             !vsh::isSameVideoFormat(&lossless_format, &detail_format)) ||
+            vi_detail->width != d->vi.width ||
+            vi_detail->height != d->vi.height * layers) {
+            fail("base and detail must have the same format and dimensions");
+            return;
+        }
+    }
+
+    if (d->mask != nullptr) {
+        const VSVideoInfo* vi_mask = vsapi->getVideoInfo(d->mask);
+        if (vi_mask->format.sampleType != d->vi.format.sampleType ||
+            vi_mask->format.bitsPerSample != d->vi.format.bitsPerSample ||
+            vi_mask->width != d->vi.width || vi_mask->height != d->vi.height ||
+            (!d->first_plane && vi_mask->format.numPlanes != 1 &&
+             !vsh::isSameVideoFormat(&d->vi.format, &vi_mask->format))) {
+            fail("mask must have the same dimensions and bit depth as base, "
+                 "and the same subsampling unless first_plane is used");
+            return;
+        }
+    }
+
+    if (!d->weights.empty()) {
+        d->weight_planes = d->weights.size() != d->details.size();
+        if (d->weight_planes && d->weights.size() != 1) {
+            fail("weights must hold one clip per detail, or a single clip "
+                 "with one plane per detail");
+            return;
+        }
+
+        for (VSNode* weight : d->weights) {
+            const VSVideoInfo* vi_weight = vsapi->getVideoInfo(weight);
+            const VSVideoFormat& wf = vi_weight->format;
+            const bool layout_ok =
+                d->weight_planes
+                    ? wf.numPlanes >= static_cast<int>(d->details.size()) &&
+                          wf.subSamplingW == 0 && wf.subSamplingH == 0
+                    : d->first_plane || wf.numPlanes == 1 ||
+                          vsh::isSameVideoFormat(&d->vi.format, &wf);
+            if (wf.sampleType != d->vi.format.sampleType ||
+                wf.bitsPerSample != d->vi.format.bitsPerSample ||
+                vi_weight->width != d->vi.width ||
+                vi_weight->height != d->vi.height || !layout_ok) {
+                fail("weights must have the same dimensions and bit depth as "
+                     "base, and a single weight clip needs an unsubsampled "
+                     "plane per detail");
+                return;
+            }
+        }
+    }
+
+    if (d->limit_overshoot &&
+        (d->overshoot < 0.0F || d->overshoot_radius < 1)) {
+        fail("overshoot must be >= 0 and overshoot_radius >= 1");
+        return;
+    }
+
+    // The reference only bounds the limit, so it would never be read.
+    if (d->reference != nullptr && !d->limit_overshoot) {
+        fail("reference needs overshoot or prop_overshoot");
+        return;
+    }
+
+    if (d->reference != nullptr) {
+        const VSVideoInfo* vi_ref = vsapi->getVideoInfo(d->reference);
+        if (!vsh::isSameVideoFormat(&vi_ref->format, &d->vi.format) ||
+            vi_ref->width != d->vi.width || vi_ref->height != d->vi.height) {
+            fail("reference must have the same format and dimensions as "
+                 "base");
+            return;
+        }
+    }
+
+    std::vector<VSFilterDependency> deps = {{d->base, rpStrictSpatial}};
+    for (VSNode* detail : d->details) {
+        if (!d->packed) {
+            deps.push_back({detail, rpStrictSpatial});
+        }
+    }
+    for (VSNode* weight : d->weights) {
+        deps.push_back({weight, rpStrictSpatial});
+    }
+    if (d->mask != nullptr) {
+        deps.push_back({d->mask, rpStrictSpatial});
+    }
+    if (d->reference != nullptr) {
+        deps.push_back({d->reference, rpStrictSpatial});
+    }
+    auto* data = d.release();
+    vsapi->createVideoFilter(out, name, &data->vi, ReplaceGetFrame,
+                             ReplaceFree, fmParallel, deps.data(),
+                             static_cast<int>(deps.size()), data, core);
+}
+
+void VS_CC ReplaceCreate(const VSMap* in, VSMap* out,
+                         [[maybe_unused]] void* userData, VSCore* core,
+                         const VSAPI* vsapi) {
+    auto d = std::make_unique<ReplaceData>();
+    int err = 0;
+
+    d->base = vsapi->mapGetNode(in, "base", 0, 0);
+    d->details = {vsapi->mapGetNode(in, "detail", 0, 0)};
+    d->mask = vsapi->mapGetNode(in, "mask", 0, &err);
+    d->vi = *vsapi->getVideoInfo(d->base);
+    d->roi = read_roi(in, d->vi, vsapi);
+    d->first_plane = vsapi->mapGetInt(in, "first_plane", 0, &err) != 0;
+    d->subtract = false;
+    d->packed = false;
+    read_overshoot(in, d.get(), vsapi);
+
+    create_replace(std::move(d), "ReplaceFrequency", out, core, vsapi);
+}
+
+struct PackData {
+    // Details of every level followed by the base.
+    std::vector<VSNode*> layers;
+    VSVideoInfo vi;
+};
+
+const VSFrame* VS_CC PackGetFrame(int n, int activationReason,
+                                  void* instanceData,
+                                  [[maybe_unused]] void** frameData,
+                                  VSFrameContext* frameCtx, VSCore* core,
+                                  const VSAPI* vsapi) {
+    auto* d = static_cast<PackData*>(instanceData);
+
+    if (activationReason == arInitial) {
+        for (VSNode* layer : d->layers) {
+            vsapi->requestFrameFilter(n, layer, frameCtx);
+        }
+    } else if (activationReason == arAllFramesReady) {
+        const auto num_layers = static_cast<int>(d->layers.size());
+        const VSFrame* base =
+            vsapi->getFrameFilter(n, d->layers.back(), frameCtx);
+        VSFrame* dst = vsapi->newVideoFrame(&d->vi.format, d->vi.width,
+                                            d->vi.height, base, core);
+
+        std::vector<int64_t> offsets;
+        for (int k = 0; k < num_layers; ++k) {
+            const VSFrame* layer =
+                k + 1 == num_layers
+                    ? vsapi->addFrameRef(base)
+                    : vsapi->getFrameFilter(n, d->layers[k], frameCtx);
+            for (int plane = 0; plane < d->vi.format.numPlanes; plane++) {
+                const int height = vsapi->getFrameHeight(layer, plane);
+                copy_plane_rows(layer, 0, dst, k * height, plane, height,
+                                vsapi);
+            }
+            offsets.push_back(static_cast<int64_t>(k) *
+                              vsapi->getFrameHeight(layer, 0));
+            vsapi->freeFrame(layer);
+        }
+
+        VSMap* props = vsapi->getFramePropertiesRW(dst);
+        vsapi->mapSetInt(props, PACKED_LEVELS_PROP, num_layers - 1,
+                         maReplace);
+        vsapi->mapSetIntArray(props, PACKED_OFFSETS_PROP, offsets.data(),
+                              num_layers);
+
+        vsapi->freeFrame(base);
+        return dst;
+    }
+    return nullptr;
+}
+
+void VS_CC PackFree(void* instanceData, [[maybe_unused]] VSCore* core,
+                    const VSAPI* vsapi) {
+    auto d = std::unique_ptr<PackData>(static_cast<PackData*>(instanceData));
+    for (VSNode* layer : d->layers) {
+        vsapi->freeNode(layer);
+    }
+}
+
+struct UnpackData {
+    VSNode* node;
+    VSVideoInfo vi;
+    int levels;
+    int layer;
+};
+
+const VSFrame* VS_CC UnpackGetFrame(int n, int activationReason,
+                                    void* instanceData,
+                                    [[maybe_unused]] void** frameData,
+                                    VSFrameContext* frameCtx, VSCore* core,
+                                    const VSAPI* vsapi) {
+    auto* d = static_cast<UnpackData*>(instanceData);
+
+    if (activationReason == arInitial) {
+        vsapi->requestFrameFilter(n, d->node, frameCtx);
+    } else if (activationReason == arAllFramesReady) {
+        const VSFrame* src = vsapi->getFrameFilter(n, d->node, frameCtx);
+        if (!packed_levels_match(src, d->levels, vsapi)) {
+            vsapi->setFilterError(
+                packed_levels_error("Unpack", n, d->levels).c_str(),
+                frameCtx);
+            vsapi->freeFrame(src);
+            return nullptr;
+        }
+
+        VSFrame* dst = vsapi->newVideoFrame(&d->vi.format, d->vi.width,
+                                            d->vi.height, src, core);
+
+        for (int plane = 0; plane < d->vi.format.numPlanes; plane++) {
+            const int height = vsapi->getFrameHeight(dst, plane);
+            copy_plane_rows(src, d->layer * height, dst, 0, plane, height,
+                            vsapi);
+        }
+
+        VSMap* props = vsapi->getFramePropertiesRW(dst);
+        vsapi->mapDeleteKey(props, PACKED_LEVELS_PROP);
+        vsapi->mapDeleteKey(props, PACKED_OFFSETS_PROP);
+
+        vsapi->freeFrame(src);
+        return dst;
+    }
+    return nullptr;
+}
+
+void VS_CC UnpackFree(void* instanceData, [[maybe_unused]] VSCore* core,
+                      const VSAPI* vsapi) {
+    auto d =
+        std::unique_ptr<UnpackData>(static_cast<UnpackData*>(instanceData));
+    vsapi->freeNode(d->node);
+}
+
+// Splits a packed pyramid back into the clip list of Decompose.
+void VS_CC UnpackCreate(const VSMap* in, VSMap* out,
+                        [[maybe_unused]] void* userData, VSCore* core,
+                        const VSAPI* vsapi) {
+    VSNode* node = vsapi->mapGetNode(in, "clip", 0, 0);
+    VSVideoInfo vi = *vsapi->getVideoInfo(node);
+
+    const int levels =
+        vsh::int64ToIntS(vsapi->mapGetInt(in, "levels", 0, nullptr));
+    if (!is_packed_shape(vi, levels)) {
+        vsapi->mapSetError(out, "Unpack: clip must be a packed pyramid of "
+                                "levels levels from Decompose(packed=True)");
+        vsapi->freeNode(node);
+        return;
+    }
+
+    vi.height /= levels + 1;
+    for (int layer = 0; layer <= levels; ++layer) {
+        auto d = std::make_unique<UnpackData>();
+        d->node = vsapi->addNodeRef(node);
+        d->vi = vi;
+        d->levels = levels;
+        d->layer = layer;
+
+        VSFilterDependency deps[] = {{node, rpStrictSpatial}};
+        auto* data = d.release();
+        vsapi->createVideoFilter(out, "Unpack", &data->vi, UnpackGetFrame,
+                                 UnpackFree, fmParallel, std::data(deps), 1,
+                                 data, core);
+    }
+    vsapi->freeNode(node);
+}
+
+// Temporal stabilization of detail levels: each chosen level is replaced by
+// the median or triangle-weighted average of the same level over
+// 2 * radius + 1 frames. The neighbouring frames come from the detail
+// node's cache, so one frame's detail is computed once for the whole
+// window.
+struct StabilizeArgs {
+    int radius;
+    bool median;
+    // One flag per level.
+    std::vector<bool> levels;
+};
+
+// Reads temporal_radius, temporal_median and temporal_levels for
+// num_levels levels. Returns false if they are out of range.
+bool read_stabilize(const VSMap* in, int num_levels, StabilizeArgs& args,
+                    const VSAPI* vsapi) {
+    int err = 0;
+    args.radius =
+        vsh::int64ToIntS(vsapi->mapGetInt(in, "temporal_radius", 0, &err));
+    if (err != 0) {
+        args.radius = 0;
+    }
+
+    args.median = vsapi->mapGetInt(in, "temporal_median", 0, &err) != 0;
+    if (err != 0) {
+        args.median = true;
+    }
+
+    const int num_chosen = vsapi->mapNumElements(in, "temporal_levels");
+    args.levels.assign(num_levels, num_chosen <= 0);
+    for (int i = 0; i < num_chosen; ++i) {
+        const int64_t level = vsapi->mapGetInt(in, "temporal_levels", i, 0);
+        if (level < 1 || level > num_levels) {
+            return false;
+        }
+        args.levels[level - 1] = true;
+    }
+    return args.radius >= 0 && args.radius <= 8;
+}
+
+constexpr const char* STABILIZE_ERROR =
+    "temporal_radius must be between 0 and 8, and temporal_levels must "
+    "name existing levels";
+
+struct StabilizeData {
+    VSNode* node;
+    VSVideoInfo vi;
+    int radius;
+    bool median;
+    // The frame is one layer, or a packed pyramid with one flag per layer.
+    std::vector<bool> filtered;
+};
+
+template <typename T>
+void stabilize_plane(const std::vector<const VSFrame*>& frames, VSFrame* dst,
+                     int plane, const StabilizeData* d, const VSAPI* vsapi) {
+    const int width = vsapi->getFrameWidth(dst, plane);
+    const int height = vsapi->getFrameHeight(dst, plane);
+    const auto layers = static_cast<int>(d->filtered.size());
+    const int layer_height = height / layers;
+    const ptrdiff_t stride = vsapi->getStride(dst, plane) / sizeof(T);
+    const int taps = (2 * d->radius) + 1;
+
+    std::vector<const T*> srcps;
+    for (const VSFrame* frame : frames) {
+        srcps.push_back(
+            reinterpret_cast<const T*>(vsapi->getReadPtr(frame, plane)));
+    }
+    T* dstp = reinterpret_cast<T*>(vsapi->getWritePtr(dst, plane));
+
+    // Triangle weights, normalized.
+    std::vector<float> weights(taps);
+    for (int k = 0; k < taps; ++k) {
+        weights[k] =
+            static_cast<float>(d->radius + 1 - std::abs(k - d->radius)) /
+            static_cast<float>((d->radius + 1) * (d->radius + 1));
+    }
+
+    std::vector<T> window(d->median ? static_cast<std::size_t>(taps) * width
+                                    : 0);
+    std::vector<float> sum(d->median ? 0 : width);
+
+    for (int layer = 0; layer < layers; ++layer) {
+        const int y_begin = layer * layer_height;
+        if (!d->filtered[layer]) {
+            copy_plane_rows(frames[d->radius], y_begin, dst, y_begin, plane,
+                            layer_height, vsapi);
+            continue;
+        }
+
+        for (int y = y_begin; y < y_begin + layer_height; ++y) {
+            T* VS_RESTRICT dst_row = dstp + (y * stride);
+
+            if (d->median) {
+                for (int k = 0; k < taps; ++k) {
+                    std::copy_n(srcps[k] + (y * stride), width,
+                                window.data() + (k * width));
+                }
+                // radius + 1 bubble passes move the largest radius + 1 rows
+                // into place, which leaves the median in row radius. Each
+                // compare-exchange is a min/max over a whole row.
+                for (int pass = 0; pass <= d->radius; ++pass) {
+                    for (int k = 0; k + 1 < taps - pass; ++k) {
+                        T* VS_RESTRICT lo = window.data() + (k * width);
+                        T* VS_RESTRICT hi = lo + width;
+                        for (int x = 0; x < width; ++x) {
+                            const T a = lo[x];
+                            const T b = hi[x];
+                            lo[x] = std::min(a, b);
+                            hi[x] = std::max(a, b);
+                        }
+                    }
+                }
+                std::copy_n(window.data() + (d->radius * width), width,
+                            dst_row);
+            } else {
+                std::fill(sum.begin(), sum.end(), 0.0F);
+                for (int k = 0; k < taps; ++k) {
+                    const T* VS_RESTRICT src_row = srcps[k] + (y * stride);
+                    const float weight = weights[k];
+                    for (int x = 0; x < width; ++x) {
+                        sum[x] += weight * static_cast<float>(src_row[x]);
+                    }
+                }
+                for (int x = 0; x < width; ++x) {
+                    if constexpr (std::integral<T>) {
+                        dst_row[x] = static_cast<T>(std::round(sum[x]));
+                    } else {
+                        dst_row[x] = sum[x];
+                    }
+                }
+            }
+        }
+    }
+}
+
+const VSFrame* VS_CC StabilizeGetFrame(int n, int activationReason,
+                                       void* instanceData,
+                                       [[maybe_unused]] void** frameData,
+                                       VSFrameContext* frameCtx, VSCore* core,
+                                       const VSAPI* vsapi) {
+    auto* d = static_cast<StabilizeData*>(instanceData);
+    const int num_frames = d->vi.numFrames;
+
+    if (activationReason == arInitial) {
+        for (int k = -d->radius; k <= d->radius; ++k) {
+            vsapi->requestFrameFilter(temporal_tap(n, k, 1, num_frames),
+                                      d->node, frameCtx);
+        }
+    } else if (activationReason == arAllFramesReady) {
+        std::vector<const VSFrame*> frames;
+        for (int k = -d->radius; k <= d->radius; ++k) {
+            frames.push_back(vsapi->getFrameFilter(
+                temporal_tap(n, k, 1, num_frames), d->node, frameCtx));
+        }
+        const VSFrame* src = frames[d->radius];
+        const VSVideoFormat* fi = vsapi->getVideoFrameFormat(src);
+        VSFrame* dst = vsapi->newVideoFrame(fi, vsapi->getFrameWidth(src, 0),
+                                            vsapi->getFrameHeight(src, 0),
+                                            src, core);
+
+        for (int plane = 0; plane < fi->numPlanes; plane++) {
+            if (fi->sampleType == stInteger) {
+                switch (fi->bytesPerSample) {
+                case 1:
+                    stabilize_plane<uint8_t>(frames, dst, plane, d, vsapi);
+                    break;
+                case 2:
+                    stabilize_plane<uint16_t>(frames, dst, plane, d, vsapi);
+                    break;
+                case 4:
+                    stabilize_plane<uint32_t>(frames, dst, plane, d, vsapi);
+                    break;
+                }
+            } else if (fi->sampleType == stFloat) {
+                switch (fi->bytesPerSample) {
+                case 4:
+                    stabilize_plane<float>(frames, dst, plane, d, vsapi);
+                    break;
+                }
+            }
+        }
+
+        for (const VSFrame* frame : frames) {
+            vsapi->freeFrame(frame);
+        }
+        return dst;
+    }
+    return nullptr;
+}
+
+void VS_CC StabilizeFree(void* instanceData, [[maybe_unused]] VSCore* core,
+                         const VSAPI* vsapi) {
+    auto d = std::unique_ptr<StabilizeData>(
+        static_cast<StabilizeData*>(instanceData));
+    vsapi->freeNode(d->node);
+}
+
+// Wraps node, taking over its reference, in a stabilizer for the layers
+// flagged in filtered. Returns node itself if there is nothing to do.
+VSNode* stabilize_node(VSNode* node, const StabilizeArgs& args,
+                       std::vector<bool> filtered, VSCore* core,
+                       const VSAPI* vsapi) {
+    if (args.radius == 0 || std::ranges::find(filtered, true) ==
+                                filtered.end()) {
+        return node;
+    }
+
+    auto d = std::make_unique<StabilizeData>();
+    d->node = node;
+    d->vi = *vsapi->getVideoInfo(node);
+    d->radius = args.radius;
+    d->median = args.median;
+    d->filtered = std::move(filtered);
+
+    VSFilterDependency deps[] = {{node, rpGeneral}};
+    auto* data = d.release();
+    return vsapi->createVideoFilter2("Stabilize", &data->vi,
+                                     StabilizeGetFrame, StabilizeFree,
+                                     fmParallel, std::data(deps), 1, data,
+                                     core);
+}
+
+void VS_CC RecomposeCreate(const VSMap* in, VSMap* out,
+                           [[maybe_unused]] void* userData, VSCore* core,
+                           const VSAPI* vsapi) {
+    const int num_clips = vsapi->mapNumElements(in, "clips");
+
+    auto d = std::make_unique<ReplaceData>();
+    int err = 0;
+
+    // A single clip is a packed pyramid from Decompose(packed=True).
+    d->packed = num_clips == 1;
+    const int levels =
+        vsh::int64ToIntS(vsapi->mapGetInt(in, "levels", 0, &err));
+    if (d->packed != (err == 0)) {
+        vsapi->mapSetError(out, "Recompose: levels must be given for a "
+                                "packed pyramid, and only for one");
+        return;
+    }
+    if (d->packed) {
+        VSNode* packed = vsapi->mapGetNode(in, "clips", 0, 0);
+        if (!is_packed_shape(*vsapi->getVideoInfo(packed), levels)) {
+            vsapi->mapSetError(out, "Recompose: a single clip must be a "
+                                    "packed pyramid of levels levels from "
+                                    "Decompose(packed=True)");
+            vsapi->freeNode(packed);
+            return;
+        }
+        StabilizeArgs stabilize{};
+        if (!read_stabilize(in, levels, stabilize, vsapi)) {
+            vsapi->mapSetError(
+                out, (std::string("Recompose: ") + STABILIZE_ERROR).c_str());
+            vsapi->freeNode(packed);
+            return;
+        }
+        // The base layer of the pyramid is never filtered.
+        std::vector<bool> filtered = stabilize.levels;
+        filtered.push_back(false);
+        d->vi = *vsapi->getVideoInfo(packed);
+        d->vi.height /= levels + 1;
+        d->base = stabilize_node(packed, stabilize, filtered, core, vsapi);
+        for (int i = 0; i < levels; ++i) {
+            d->details.push_back(vsapi->addNodeRef(d->base));
+        }
+    } else {
+        StabilizeArgs stabilize{};
+        if (!read_stabilize(in, num_clips - 1, stabilize, vsapi)) {
+            vsapi->mapSetError(
+                out, (std::string("Recompose: ") + STABILIZE_ERROR).c_str());
+            return;
+        }
+        for (int i = 0; i < num_clips - 1; ++i) {
+            d->details.push_back(stabilize_node(
+                vsapi->mapGetNode(in, "clips", i, 0), stabilize,
+                {stabilize.levels[i]}, core, vsapi));
+        }
+        d->base = vsapi->mapGetNode(in, "clips", num_clips - 1, 0);
+        d->vi = *vsapi->getVideoInfo(d->base);
+    }
+    for (int i = 0; i < vsapi->mapNumElements(in, "weights"); ++i) {
+        d->weights.push_back(vsapi->mapGetNode(in, "weights", i, 0));
+    }
+    d->mask = vsapi->mapGetNode(in, "mask", 0, &err);
+    d->roi = {0, 0, d->vi.width, d->vi.height};
+    d->first_plane = vsapi->mapGetInt(in, "first_plane", 0, &err) != 0;
+    d->subtract = false;
+    read_overshoot(in, d.get(), vsapi);
+
+    create_replace(std::move(d), "Recompose", out, core, vsapi);
+}
+
+// Decompose(packed=True) in one node: the whole pyramid of a frame is made
+// by cascade_tile, so the source is read once and each layer written once.
+struct CascadeData {
+    VSNode* node;
+    // Of the packed frame.
+    VSVideoInfo vi;
+    std::array<int, 3> levels;
+    int max_levels;
+    int threads;
+    std::shared_ptr<StripPool> pool;
+};
+
+template <typename T>
+void cascade_plane(const VSFrame* src, VSFrame* dst, int plane,
+                   const CascadeData* d, const VSAPI* vsapi) {
+    const int width = vsapi->getFrameWidth(src, plane);
+    const int height = vsapi->getFrameHeight(src, plane);
+    const ptrdiff_t src_stride = vsapi->getStride(src, plane) / sizeof(T);
+    const ptrdiff_t dst_stride = vsapi->getStride(dst, plane) / sizeof(T);
+    const VSVideoFormat* fi = &d->vi.format;
+
+    const T* VS_RESTRICT srcp =
+        reinterpret_cast<const T*>(vsapi->getReadPtr(src, plane));
+    T* VS_RESTRICT dstp = reinterpret_cast<T*>(vsapi->getWritePtr(dst, plane));
+
+    auto layer_row = [&](int layer, int y) {
+        return dstp + ((static_cast<ptrdiff_t>(layer) * height + y) *
+                       dst_stride);
+    };
+
+    const int levels = d->levels[plane];
+    const float neutral = get_neutral<T>(fi);
+    const float max_val = get_max<T>(fi);
+
+    // Planes with fewer levels get neutral details past their last level.
+    for (int k = levels; k < d->max_levels; ++k) {
+        for (int y = 0; y < height; ++y) {
+            std::fill_n(layer_row(k, y), width, static_cast<T>(neutral));
+        }
+    }
+
+    const int tile = cascade_tile_width(width, levels, d->threads);
+    for_each_strip(
+        d->pool.get(), (width + tile - 1) / tile, d->threads,
+        [] { return CascadeScratch{}; },
+        [&](CascadeScratch& scratch, int i) {
+            const int left = i * tile;
+            const int right = std::min(left + tile, width);
+
+            auto load = [&](int y, int x_begin, int x_end,
+                            float* VS_RESTRICT base) {
+                const T* VS_RESTRICT src_row = srcp + (y * src_stride);
+                for (int x = x_begin; x < x_end; ++x) {
+                    base[x - x_begin] = static_cast<float>(src_row[x]);
+                }
+            };
+
+            // The same rounding as ExtractFrequency followed by the
+            // subtracting ReplaceFrequency, so the layers match the unpacked
+            // Decompose. Nothing is accumulated, so the detail goes to acc
+            // first; only the tile's own columns of it are written, the halo
+            // belongs to the neighbouring tiles.
+            auto band = [&](int level, int y, int x_begin, int x_end,
+                            const float* VS_RESTRICT base,
+                            const float* VS_RESTRICT blur,
+                            float* VS_RESTRICT next,
+                            float* VS_RESTRICT detail) {
+                for (int x = 0; x < x_end - x_begin; ++x) {
+                    detail[x] = base[x] - blur[x] + neutral;
+                    if constexpr (std::integral<T>) {
+                        detail[x] =
+                            std::clamp(std::round(detail[x]), 0.0F, max_val);
+                        next[x] = std::clamp(base[x] - (detail[x] - neutral),
+                                             0.0F, max_val);
+                    } else {
+                        next[x] = base[x] - (detail[x] - neutral);
+                    }
+                }
+
+                T* VS_RESTRICT dst_row = layer_row(level, y);
+                for (int x = left; x < right; ++x) {
+                    dst_row[x] = static_cast<T>(detail[x - x_begin]);
+                }
+            };
+
+            auto store = [&](int y, int x_begin, int x_end,
+                             const float* VS_RESTRICT base,
+                             [[maybe_unused]] const float* acc) {
+                T* VS_RESTRICT dst_row = layer_row(d->max_levels, y);
+                for (int x = x_begin; x < x_end; ++x) {
+                    dst_row[x] = static_cast<T>(base[x - x_begin]);
+                }
+            };
+
+            cascade_tile(width, height, levels, left, right, scratch, load,
+                         band, store);
+        });
+}
+
+const VSFrame* VS_CC CascadeGetFrame(int n, int activationReason,
+                                     void* instanceData,
+                                     [[maybe_unused]] void** frameData,
+                                     VSFrameContext* frameCtx, VSCore* core,
+                                     const VSAPI* vsapi) {
+    auto* d = static_cast<CascadeData*>(instanceData);
+
+    if (activationReason == arInitial) {
+        vsapi->requestFrameFilter(n, d->node, frameCtx);
+    } else if (activationReason == arAllFramesReady) {
+        const VSFrame* src = vsapi->getFrameFilter(n, d->node, frameCtx);
+        const VSVideoFormat* fi = vsapi->getVideoFrameFormat(src);
+        VSFrame* dst = vsapi->newVideoFrame(fi, d->vi.width, d->vi.height,
+                                            src, core);
+
+        for (int plane = 0; plane < fi->numPlanes; plane++) {
+            if (fi->sampleType == stInteger) {
+                switch (fi->bytesPerSample) {
+                case 1:
+                    cascade_plane<uint8_t>(src, dst, plane, d, vsapi);
+                    break;
+                case 2:
+                    cascade_plane<uint16_t>(src, dst, plane, d, vsapi);
+                    break;
+                }
+            } else if (fi->sampleType == stFloat) {
+                switch (fi->bytesPerSample) {
+                case 4:
+                    cascade_plane<float>(src, dst, plane, d, vsapi);
+                    break;
+                }
+            }
+        }
+
+        std::vector<int64_t> offsets;
+        const int height = vsapi->getFrameHeight(src, 0);
+        for (int k = 0; k <= d->max_levels; ++k) {
+            offsets.push_back(static_cast<int64_t>(k) * height);
+        }
+        VSMap* props = vsapi->getFramePropertiesRW(dst);
+        vsapi->mapSetInt(props, PACKED_LEVELS_PROP, d->max_levels, maReplace);
+        vsapi->mapSetIntArray(props, PACKED_OFFSETS_PROP, offsets.data(),
+                              static_cast<int>(offsets.size()));
+
+        vsapi->freeFrame(src);
+        return dst;
+    }
+    return nullptr;
+}
+
+void VS_CC CascadeFree(void* instanceData, [[maybe_unused]] VSCore* core,
+                       const VSAPI* vsapi) {
+    auto d =
+        std::unique_ptr<CascadeData>(static_cast<CascadeData*>(instanceData));
+    vsapi->freeNode(d->node);
+}
+
+// Builds the level chain natively: each level is an ExtractFrequency node
+// on the previous base, and the next base is that base minus the detail.
+void VS_CC DecomposeCreate(const VSMap* in, VSMap* out,
+                           [[maybe_unused]] void* userData, VSCore* core,
+                           const VSAPI* vsapi) {
+    int err = 0;
+
+    VSNode* node = vsapi->mapGetNode(in, "clip", 0, 0);
+    const VSVideoInfo vi = *vsapi->getVideoInfo(node);
+
+    std::array<int, 3> levels = {2, 2, 2};
+    const bool levels_ok = read_plane_values(in, "levels", levels, vsapi);
+
+    const bool lossless = vsapi->mapGetInt(in, "lossless", 0, &err) != 0;
+    const bool packed = vsapi->mapGetInt(in, "packed", 0, &err) != 0;
+    const bool normalize = vsapi->mapGetInt(in, "normalize", 0, &err) != 0;
+
+    float eps = vsapi->mapGetFloatSaturated(in, "eps", 0, &err);
+    if (err != 0) {
+        eps = 1e-4F;
+    }
+
+    float max_gain = vsapi->mapGetFloatSaturated(in, "max_gain", 0, &err);
+    if (err != 0) {
+        max_gain = 8.0F;
+    }
+
+    const std::string prop_eps = read_prop_name(in, "prop_eps", vsapi);
+    const std::string prop_max_gain =
+        read_prop_name(in, "prop_max_gain", vsapi);
+
+    int threads = vsh::int64ToIntS(vsapi->mapGetInt(in, "threads", 0, &err));
+    if (err != 0) {
+        threads = 1;
+    }
+    if (threads == 0) {
+        threads =
+            std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+    }
+
+    if (!levels_ok || std::ranges::min(levels) < 1 || threads < 0) {
+        vsapi->mapSetError(out, "Decompose: levels must be >= 1, with at most "
+                                "one value per plane, and threads >= 0");
+        vsapi->freeNode(node);
+        return;
+    }
+
+    if (!vsh::isConstantVideoFormat(&vi) || !is_supported_format(vi.format) ||
+        (lossless && vi.format.sampleType != stInteger)) {
+        vsapi->mapSetError(out, "Decompose: only constant 8-16 bit integer or "
+                                "32 bit float input are accepted, and "
+                                "lossless requires integer input");
+        vsapi->freeNode(node);
+        return;
+    }
+
+    if (!levels_fit(vi, levels, levels)) {
+        vsapi->mapSetError(out, "Decompose: 2^levels must be smaller than the "
+                                "width and height of every plane");
+        vsapi->freeNode(node);
+        return;
+    }
+
+    // The layers of a packed pyramid share one format.
+    if (packed && lossless) {
+        vsapi->mapSetError(out, "Decompose: packed cannot be combined with "
+                                "lossless");
+        vsapi->freeNode(node);
+        return;
+    }
+
+    // Lossless details are never normalized.
+    if (eps <= 0.0F || max_gain <= 0.0F || (normalize && lossless)) {
+        vsapi->mapSetError(out, "Decompose: eps and max_gain must be > 0, "
+                                "and normalize cannot be combined with "
+                                "lossless");
+        vsapi->freeNode(node);
+        return;
+    }
+
+    VSVideoInfo detail_vi = vi;
+    if (lossless) {
+        vsapi->queryVideoFormat(&detail_vi.format, vi.format.colorFamily,
+                                stInteger,
+                                lossless_detail_bits(vi.format.bitsPerSample),
+                                vi.format.subSamplingW, vi.format.subSamplingH,
+                                core);
+    }
+
+    auto pd = std::make_unique<PackData>();
+    VSNode* base = node;
+    // Planes with fewer levels get zero details past their last level, which
+    // leaves their base unchanged.
+    const int max_levels = *std::max_element(
+        levels.begin(), levels.begin() + vi.format.numPlanes);
+
+    StabilizeArgs stabilize{};
+    if (!read_stabilize(in, max_levels, stabilize, vsapi)) {
+        vsapi->mapSetError(
+            out, (std::string("Decompose: ") + STABILIZE_ERROR).c_str());
+        vsapi->freeNode(node);
+        return;
+    }
+
+    // All nodes of the pyramid share one set of workers.
+    const std::shared_ptr<StripPool> pool = make_strip_pool(threads);
+
+    // Without temporal filtering or normalization a packed pyramid is made
+    // in one sweep.
+    if (packed && stabilize.radius == 0 && !normalize) {
+        auto cd = std::make_unique<CascadeData>();
+        cd->node = node;
+        cd->vi = vi;
+        cd->vi.height *= max_levels + 1;
+        cd->levels = levels;
+        cd->max_levels = max_levels;
+        cd->threads = threads;
+        cd->pool = pool;
+
+        VSFilterDependency deps[] = {{node, rpStrictSpatial}};
+        auto* data = cd.release();
+        vsapi->createVideoFilter(out, "Decompose", &data->vi, CascadeGetFrame,
+                                 CascadeFree, fmParallel, std::data(deps), 1,
+                                 data, core);
+        return;
+    }
+
+    for (int level = 1; level <= max_levels; ++level) {
+        std::array<int, 3> radius{};
+        for (int plane = 0; plane < 3; ++plane) {
+            radius[plane] = level <= levels[plane] ? level : 0;
+        }
+
+        auto ed = std::make_unique<ATWTData>();
+        ed->node = vsapi->addNodeRef(base);
+        ed->vi = detail_vi;
+        ed->roi = {0, 0, vi.width, vi.height};
+        ed->radius_h = radius;
+        ed->radius_v = radius;
+        ed->threads = threads;
+        ed->pool = pool;
+        ed->normalize = false;
+        ed->eps = 1e-4F;
+        ed->max_gain = 8.0F;
+        ed->lossless = lossless;
+
+        VSFilterDependency extract_deps[] = {{base, rpStrictSpatial}};
+        VSNode* detail = vsapi->createVideoFilter2(
+            "ExtractFrequency", &detail_vi, ExtractGetFrame, ExtractFree,
+            fmParallel, std::data(extract_deps), 1, ed.release(), core);
+
+        auto rd = std::make_unique<ReplaceData>();
+        rd->base = base;
+        rd->details = {vsapi->addNodeRef(detail)};
+        rd->mask = nullptr;
+        rd->reference = nullptr;
+        rd->limit_overshoot = false;
+        rd->overshoot = 0.0F;
+        rd->gain = 1.0F;
+        rd->vi = vi;
+        rd->roi = {0, 0, vi.width, vi.height};
+        rd->first_plane = false;
+        rd->subtract = true;
+        rd->packed = false;
+
+        VSFilterDependency base_deps[] = {{base, rpStrictSpatial},
+                                          {detail, rpStrictSpatial}};
+        base = vsapi->createVideoFilter2(
+            "Decompose", &vi, ReplaceGetFrame, ReplaceFree, fmParallel,
+            std::data(base_deps), 2, rd.release(), core);
+
+        // The next base is built from the raw detail, so normalizing only
+        // changes the detail output and reuses the level's blur.
+        if (normalize) {
+            auto nd = std::make_unique<ATWTData>();
+            nd->node = detail;
+            nd->vi = vi;
+            nd->roi = {0, 0, vi.width, vi.height};
+            nd->radius_h = radius;
+            nd->radius_v = radius;
+            nd->threads = threads;
+            nd->pool = pool;
+            nd->normalize = true;
+            nd->eps = eps;
+            nd->max_gain = max_gain;
+            nd->prop_eps = prop_eps;
+            nd->prop_max_gain = prop_max_gain;
+            nd->lossless = false;
+
+            VSFilterDependency normalize_deps[] = {{detail, rpStrictSpatial}};
+            detail = vsapi->createVideoFilter2(
+                "Decompose", &vi, NormalizeGetFrame, ExtractFree, fmParallel,
+                std::data(normalize_deps), 1, nd.release(), core);
+        }
+
+        // The next base is built from the unfiltered detail, so Recompose
+        // restores the source up to the stabilized change.
+        detail = stabilize_node(detail, stabilize,
+                                {stabilize.levels[level - 1]}, core, vsapi);
+        if (packed) {
+            pd->layers.push_back(detail);
+        } else {
+            vsapi->mapConsumeNode(out, "clip", detail, maAppend);
+        }
+    }
+
+    if (!packed) {
+        vsapi->mapConsumeNode(out, "clip", base, maAppend);
+        return;
+    }
+
+    pd->layers.push_back(base);
+    pd->vi = vi;
+    pd->vi.height *= static_cast<int>(pd->layers.size());
+    std::vector<VSFilterDependency> deps;
+    for (VSNode* layer : pd->layers) {
+        deps.push_back({layer, rpStrictSpatial});
+    }
+    auto* data = pd.release();
+    vsapi->createVideoFilter(out, "Decompose", &data->vi, PackGetFrame,
+                             PackFree, fmParallel, deps.data(),
+                             static_cast<int>(deps.size()), data, core);
+}
+
+// Local tone mapping in the log domain: the plane's log2 is decomposed with
+// the same cascade as Decompose, the base is scaled by compression and the
+// detail levels are added back with their own gains.
+struct ToneData {
+    VSNode* node;
+    VSVideoInfo vi;
+    int levels;
+    float compression;
+    std::vector<float> detail_gain;
+    // log2 of every value of the sample type relative to the peak
+    std::vector<float> log_lut;
+    // Frame properties overriding compression and detail_gain per frame.
+    std::string prop_compression;
+    std::string prop_detail_gain;
+};
+
+// Floor of linear float input, so that black keeps a finite log.
+constexpr float TONE_BLACK = 1e-5F;
+
+template <typename T>
+void tone_compress_plane(const VSFrame* src, VSFrame* dst, int plane,
+                         const ToneData* d, float compression,
+                         const std::vector<float>& detail_gain,
+                         const VSAPI* vsapi) {
+    const int width = vsapi->getFrameWidth(src, plane);
+    const int height = vsapi->getFrameHeight(src, plane);
+    const ptrdiff_t src_stride = vsapi->getStride(src, plane) / sizeof(T);
+    const ptrdiff_t dst_stride = vsapi->getStride(dst, plane) / sizeof(T);
+    const VSVideoFormat* fi = &d->vi.format;
+
+    const T* VS_RESTRICT srcp =
+        reinterpret_cast<const T*>(vsapi->getReadPtr(src, plane));
+    T* VS_RESTRICT dstp = reinterpret_cast<T*>(vsapi->getWritePtr(dst, plane));
+
+    const float max_val = get_max<T>(fi);
+
+    auto load = [&](int y, int x_begin, int x_end, float* VS_RESTRICT base) {
+        const T* VS_RESTRICT src_row = srcp + (y * src_stride);
+        for (int x = x_begin; x < x_end; ++x) {
+            if constexpr (std::integral<T>) {
+                base[x - x_begin] = d->log_lut[src_row[x]];
+            } else {
+                base[x - x_begin] =
+                    std::log2(std::max(src_row[x], TONE_BLACK));
+            }
+        }
+    };
+
+    // Each level peels the detail off the base, as in Decompose, and adds it
+    // to the weighted sum with its gain.
+    auto band = [&](int level, [[maybe_unused]] int y, int x_begin, int x_end,
+                    const float* VS_RESTRICT base,
+                    const float* VS_RESTRICT blur, float* VS_RESTRICT next,
+                    float* VS_RESTRICT weighted) {
+        const float gain = detail_gain[level];
+        for (int x = 0; x < x_end - x_begin; ++x) {
+            const float l = base[x] - blur[x];
+            weighted[x] += gain * l;
+            next[x] = base[x] - l;
+        }
+    };
+
+    auto store = [&](int y, int x_begin, int x_end,
+                     const float* VS_RESTRICT base,
+                     const float* VS_RESTRICT weighted) {
+        T* VS_RESTRICT dst_row = dstp + (y * dst_stride) + x_begin;
+        for (int x = 0; x < x_end - x_begin; ++x) {
+            float val = std::exp2((compression * base[x]) + weighted[x]);
+            if constexpr (std::integral<T>) {
+                dst_row[x] = static_cast<T>(
+                    std::clamp(std::round(val * max_val), 0.0F, max_val));
+            } else {
+                dst_row[x] = val;
+            }
+        }
+    };
+
+    CascadeScratch scratch;
+    const int tile = cascade_tile_width(width, d->levels, 1);
+    for (int left = 0; left < width; left += tile) {
+        cascade_tile(width, height, d->levels, left,
+                     std::min(left + tile, width), scratch, load, band, store);
+    }
+}
+
+const VSFrame* VS_CC ToneGetFrame(int n, int activationReason,
+                                  void* instanceData,
+                                  [[maybe_unused]] void** frameData,
+                                  VSFrameContext* frameCtx, VSCore* core,
+                                  const VSAPI* vsapi) {
+    auto* d = static_cast<ToneData*>(instanceData);
+
+    if (activationReason == arInitial) {
+        vsapi->requestFrameFilter(n, d->node, frameCtx);
+    } else if (activationReason == arAllFramesReady) {
+        const VSFrame* src = vsapi->getFrameFilter(n, d->node, frameCtx);
+        const VSVideoFormat* fi = vsapi->getVideoFrameFormat(src);
+        const int width = vsapi->getFrameWidth(src, 0);
+        const int height = vsapi->getFrameHeight(src, 0);
+
+        const float compression =
+            frame_param(src, d->prop_compression, d->compression, vsapi);
+        if (compression <= 0.0F) {
+            vsapi->setFilterError("ToneCompress: compression must be > 0",
+                                  frameCtx);
+            vsapi->freeFrame(src);
+            return nullptr;
+        }
+
+        // A per-frame detail_gain array repeats its last value like the
+        // argument does.
+        std::vector<float> detail_gain = d->detail_gain;
+        if (!d->prop_detail_gain.empty()) {
+            const VSMap* props = vsapi->getFramePropertiesRO(src);
+            const char* key = d->prop_detail_gain.c_str();
+            const int num_gains =
+                std::min(vsapi->mapNumElements(props, key), d->levels);
+            for (int level = 0; num_gains > 0 && level < d->levels;
+                 ++level) {
+                int err = 0;
+                const int i = std::min(level, num_gains - 1);
+                const double gain = vsapi->mapGetFloat(props, key, i, &err);
+                detail_gain[level] =
+                    err == 0 ? static_cast<float>(gain)
+                             : static_cast<float>(
+                                   vsapi->mapGetInt(props, key, i, &err));
+                if (err != 0) {
+                    detail_gain[level] = d->detail_gain[level];
+                }
+            }
+        }
+
+        // YUV chroma is not a light level; it is passed through by
+        // reference and only luma is tone mapped.
+        const bool luma_only = fi->colorFamily == cfYUV;
+        const VSFrame* plane_src[3] = {nullptr, src, src};
+        const int planes[3] = {0, 1, 2};
+        VSFrame* dst =
+            luma_only ? vsapi->newVideoFrame2(fi, width, height, plane_src,
+                                              planes, src, core)
+                      : vsapi->newVideoFrame(fi, width, height, src, core);
+
+        for (int plane = 0; plane < (luma_only ? 1 : fi->numPlanes);
+             plane++) {
+            if (fi->sampleType == stInteger) {
+                switch (fi->bytesPerSample) {
+                case 1:
+                    tone_compress_plane<uint8_t>(src, dst, plane, d,
+                                                 compression, detail_gain,
+                                                 vsapi);
+                    break;
+                case 2:
+                    tone_compress_plane<uint16_t>(src, dst, plane, d,
+                                                  compression, detail_gain,
+                                                  vsapi);
+                    break;
+                }
+            } else if (fi->sampleType == stFloat) {
+                switch (fi->bytesPerSample) {
+                case 4:
+                    tone_compress_plane<float>(src, dst, plane, d, compression,
+                                               detail_gain, vsapi);
+                    break;
+                }
+            }
+        }
+
+        vsapi->freeFrame(src);
+        return dst;
+    }
+    return nullptr;
+}
+
+void VS_CC ToneFree(void* instanceData, [[maybe_unused]] VSCore* core,
+                    const VSAPI* vsapi) {
+    auto d = std::unique_ptr<ToneData>(static_cast<ToneData*>(instanceData));
+    vsapi->freeNode(d->node);
+}
+
+void VS_CC ToneCreate(const VSMap* in, VSMap* out,
+                      [[maybe_unused]] void* userData, VSCore* core,
+                      const VSAPI* vsapi) {
+    auto d = std::make_unique<ToneData>();
+    int err = 0;
+
+    d->node = vsapi->mapGetNode(in, "clip", 0, 0);
+    d->vi = *vsapi->getVideoInfo(d->node);
+
+    d->levels = vsh::int64ToIntS(vsapi->mapGetInt(in, "levels", 0, &err));
+    if (err != 0) {
+        d->levels = 4;
+    }
+
+    d->compression = vsapi->mapGetFloatSaturated(in, "compression", 0, &err);
+    if (err != 0) {
+        d->compression = 0.5F;
+    }
+
+    const int num_gains = vsapi->mapNumElements(in, "detail_gain");
+    d->prop_compression = read_prop_name(in, "prop_compression", vsapi);
+    d->prop_detail_gain = read_prop_name(in, "prop_detail_gain", vsapi);
+
+    if (d->levels < 1 || d->compression <= 0.0F || num_gains > d->levels) {
+        vsapi->mapSetError(out, "ToneCompress: levels must be >= 1, "
+                                "compression > 0 and detail_gain must not "
+                                "have more values than levels");
+        vsapi->freeNode(d->node);
+        return;
+    }
+
+    if (!vsh::isConstantVideoFormat(&d->vi) ||
+        !is_supported_format(d->vi.format)) {
+        vsapi->mapSetError(out, "ToneCompress: only constant 8-16 bit integer "
+                                "or 32 bit float input are accepted");
+        vsapi->freeNode(d->node);
+        return;
+    }
+
+    // YUV chroma is passed through, so only luma has to fit the levels.
+    const std::array<int, 3> levels =
+        d->vi.format.colorFamily == cfYUV
+            ? std::array<int, 3>{d->levels, 0, 0}
+            : std::array<int, 3>{d->levels, d->levels, d->levels};
+    if (!levels_fit(d->vi, levels, levels)) {
+        vsapi->mapSetError(out, "ToneCompress: 2^levels must be smaller than "
+                                "the width and height of every processed "
+                                "plane");
+        vsapi->freeNode(d->node);
+        return;
+    }
+
+    // Levels past the end of detail_gain repeat its last value.
+    d->detail_gain.assign(d->levels, 1.0F);
+    for (int level = 0; num_gains > 0 && level < d->levels; ++level) {
+        d->detail_gain[level] = vsapi->mapGetFloatSaturated(
+            in, "detail_gain", std::min(level, num_gains - 1), nullptr);
+    }
+
+    if (d->vi.format.sampleType == stInteger) {
+        const float max_val = get_max<uint16_t>(&d->vi.format);
+        // Covers every value the sample type holds: codes above the peak of
+        // bitsPerSample are valid input and clip to the peak.
+        const std::size_t codes = std::size_t{1}
+                                  << d->vi.format.bitsPerSample;
+        d->log_lut.resize(std::size_t{1}
+                          << (8 * d->vi.format.bytesPerSample));
+        for (std::size_t i = 0; i < codes; ++i) {
+            d->log_lut[i] = std::log2(
+                std::max(static_cast<float>(i), 0.5F) / max_val);
+        }
+        std::fill(d->log_lut.begin() + static_cast<ptrdiff_t>(codes),
+                  d->log_lut.end(), d->log_lut[codes - 1]);
+    }
+
+    VSFilterDependency deps[] = {{d->node, rpStrictSpatial}};
+    auto* data = d.release();
+    vsapi->createVideoFilter(out, "ToneCompress", &data->vi, ToneGetFrame,
+                             ToneFree, fmParallel, std::data(deps), 1, data,
+                             core);
+}
+
+// Per-band coefficient processing: each level's detail is replaced by an
+// RPN expression of itself before the levels are summed back onto the base.
+// The expressions are compiled once into a small stack program that runs
+// over blocks of pixels, so every instruction is a vectorizable loop.
+enum class ExprOpcode {
+    LoadCoefficient,
+    LoadBase,
+    Constant,
+    // Frame property arg of the program, constant over a frame.
+    Property,
+    Add,
+    Sub,
+    Mul,
+    Div,
+    Max,
+    Min,
+    Pow,
+    Greater,
+    Less,
+    Equal,
+    GreaterEqual,
+    LessEqual,
+    And,
+    Or,
+    Xor,
+    Abs,
+    Sqrt,
+    Exp,
+    Log,
+    Not,
+    Ternary,
+    Dup,
+    Swap,
+};
+
+struct ExprOp {
+    ExprOpcode code;
+    float value;
+    int arg;
+};
+
+struct ExprProgram {
+    // Empty for an empty expression, which keeps the coefficient.
+    std::vector<ExprOp> ops;
+    int depth;
+    // Frame properties read by x.Name tokens.
+    std::vector<std::string> props;
+};
+
+// Pixels evaluated per instruction.
+constexpr int EXPR_BLOCK = 64;
+
+using ExprStack = std::vector<std::array<float, EXPR_BLOCK>>;
+
+// Matches name or name followed by a stack index, as in dup2.
+bool parse_stack_token(const std::string& token, const char* name,
+                       int default_arg, int& arg) {
+    const std::size_t length = std::strlen(name);
+    if (token.compare(0, length, name) != 0) {
+        return false;
+    }
+    const std::string suffix = token.substr(length);
+    if (suffix.empty()) {
+        arg = default_arg;
+        return true;
+    }
+    if (suffix.size() > 4 ||
+        suffix.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
     }
-    return pos;
+    arg = std::stoi(suffix);
+    return true;
 }
 
-template <typename T>
-void conv_h(const T* VS_RESTRICT src, float* VS_RESTRICT dst, int width,
-            int height, ptrdiff_t src_stride, int step) {
-    for (int y = 0; y < height; ++y) {
-        const T* VS_RESTRICT src_row = src + (y * src_stride);
-        float* VS_RESTRICT dst_row = dst + (y * width);
+// Compiles an expression for one level, where l is a constant. Returns an
+// empty string on success, or the error.
+std::string compile_expr(const std::string& expr, int level,
+                         ExprProgram& program) {
+    struct Token {
+        const char* name;
+        ExprOpcode code;
+        int pops;
+    };
+    static constexpr Token TOKENS[] = {
+        {"+", ExprOpcode::Add, 2},
+        {"-", ExprOpcode::Sub, 2},
+        {"*", ExprOpcode::Mul, 2},
+        {"/", ExprOpcode::Div, 2},
+        {"max", ExprOpcode::Max, 2},
+        {"min", ExprOpcode::Min, 2},
+        {"pow", ExprOpcode::Pow, 2},
+        {">", ExprOpcode::Greater, 2},
+        {"<", ExprOpcode::Less, 2},
+        {"=", ExprOpcode::Equal, 2},
+        {">=", ExprOpcode::GreaterEqual, 2},
+        {"<=", ExprOpcode::LessEqual, 2},
+        {"and", ExprOpcode::And, 2},
+        {"or", ExprOpcode::Or, 2},
+        {"xor", ExprOpcode::Xor, 2},
+        {"abs", ExprOpcode::Abs, 1},
+        {"sqrt", ExprOpcode::Sqrt, 1},
+        {"exp", ExprOpcode::Exp, 1},
+        {"log", ExprOpcode::Log, 1},
+        {"not", ExprOpcode::Not, 1},
+        {"?", ExprOpcode::Ternary, 3},
+    };
 
-        for (int x = 0; x < width; ++x) {
-            float sum = 0.0F;
-            for (int k = -2; k <= 2; ++k) {
-                int offset_idx = mirror_boundary(x + (k * step), width);
-                sum +=
-                    static_cast<float>(src_row[offset_idx]) * KERNEL.at(k + 2);
-            }
-            dst_row[x] = sum;
-        }
-    }
-}
+    program.ops.clear();
+    program.props.clear();
+    program.depth = 0;
+    int depth = 0;
 
-template <typename T>
-void conv_v_and_extract(const float* VS_RESTRICT temp_src,
-                        const T* VS_RESTRICT orig_src, T* VS_RESTRICT dst,
-                        int width, int height, ptrdiff_t src_stride,
-                        ptrdiff_t dst_stride, int step,
-                        const VSVideoFormat* fi) {
+    auto push = [&](ExprOpcode code, float value, int arg) {
+        program.ops.push_back({code, value, arg});
+        program.depth = std::max(program.depth, ++depth);
+    };
 
-    const float neutral = get_neutral<T>(fi);
-    const float max_val = get_max<T>(fi);
+    std::size_t pos = 0;
+    while (true) {
+        pos = expr.find_first_not_of(" \t\n", pos);
+        if (pos == std::string::npos) {
+            break;
+        }
+        const std::size_t end = std::min(expr.find_first_of(" \t\n", pos),
+                                         expr.size());
+        const std::string token = expr.substr(pos, end - pos);
+        pos = end;
 
-    for (int y = 0; y < height; ++y) {
-        const T* VS_RESTRICT src_row = orig_src + (y * src_stride);
-        T* VS_RESTRICT dst_row = dst + (y * dst_stride);
+        if (token == "x") {
+            push(ExprOpcode::LoadCoefficient, 0.0F, 0);
+            continue;
+        }
+        if (token == "b") {
+            push(ExprOpcode::LoadBase, 0.0F, 0);
+            continue;
+        }
+        if (token == "l") {
+            push(ExprOpcode::Constant, static_cast<float>(level), 0);
+            continue;
+        }
+        if (token.size() > 2 && token.compare(0, 2, "x.") == 0) {
+            push(ExprOpcode::Property, 0.0F,
+                 static_cast<int>(program.props.size()));
+            program.props.push_back(token.substr(2));
+            continue;
+        }
 
-        for (int x = 0; x < width; ++x) {
-            float sum = 0.0F;
-            for (int k = -2; k <= 2; ++k) {
-                int y_tap = mirror_boundary(y + (k * step), height);
-                sum += temp_src[(y_tap * width) + x] * KERNEL.at(k + 2);
+        const auto* op =
+            std::ranges::find_if(TOKENS, [&](const Token& t) {
+                return token == t.name;
+            });
+        if (op != std::end(TOKENS)) {
+            if (depth < op->pops) {
+                return "insufficient values on the stack for " + token;
+            }
+            depth -= op->pops;
+            push(op->code, 0.0F, 0);
+            continue;
+        }
+
+        // dupN and swapN address the Nth value below the top.
+        int arg = 0;
+        if (parse_stack_token(token, "dup", 0, arg)) {
+            if (depth <= arg) {
+                return "insufficient values on the stack for " + token;
+            }
+            push(ExprOpcode::Dup, 0.0F, arg);
+            continue;
+        }
+        if (parse_stack_token(token, "swap", 1, arg)) {
+            if (arg < 1 || depth <= arg) {
+                return "insufficient values on the stack for " + token;
             }
+            program.ops.push_back({ExprOpcode::Swap, 0.0F, arg});
+            continue;
+        }
+
+        std::size_t used = 0;
+        float value = 0.0F;
+        try {
+            value = std::stof(token, &used);
+        } catch (const std::exception&) {
+            used = 0;
+        }
+        if (used != token.size()) {
+            return "unknown token " + token;
+        }
+        push(ExprOpcode::Constant, value, 0);
+    }
 
-            // Kernel sum is 16*16 = 256
-            float blurred_pixel = sum / 256.0F;
-            auto original_pixel = static_cast<float>(src_row[x]);
+    if (!program.ops.empty() && depth != 1) {
+        return "the expression must leave exactly one value on the stack";
+    }
+    return {};
+}
 
-            float detail = original_pixel - blurred_pixel + neutral;
+// Evaluates a program over n <= EXPR_BLOCK pixels.
+void run_expr(const ExprProgram& program, const float* VS_RESTRICT x,
+              const float* VS_RESTRICT b, const std::vector<float>& props,
+              float* VS_RESTRICT result, int n, ExprStack& stack) {
+    int sp = 0;
 
-            if constexpr (std::integral<T>) {
-                dst_row[x] = static_cast<T>(
-                    std::clamp(std::round(detail), 0.0F, max_val));
-            } else {
-                dst_row[x] = detail;
+    auto unary = [&](auto f) {
+        float* VS_RESTRICT a = stack[sp - 1].data();
+        for (int i = 0; i < n; ++i) {
+            a[i] = f(a[i]);
+        }
+    };
+    auto binary = [&](auto f) {
+        float* VS_RESTRICT a = stack[sp - 2].data();
+        const float* VS_RESTRICT c = stack[sp - 1].data();
+        for (int i = 0; i < n; ++i) {
+            a[i] = f(a[i], c[i]);
+        }
+        --sp;
+    };
+    auto truth = [](float v) { return v > 0.0F; };
+    auto flag = [](bool v) { return v ? 1.0F : 0.0F; };
+
+    for (const ExprOp& op : program.ops) {
+        switch (op.code) {
+        case ExprOpcode::LoadCoefficient:
+            std::copy_n(x, n, stack[sp++].data());
+            break;
+        case ExprOpcode::LoadBase:
+            std::copy_n(b, n, stack[sp++].data());
+            break;
+        case ExprOpcode::Constant:
+            std::fill_n(stack[sp++].data(), n, op.value);
+            break;
+        case ExprOpcode::Property:
+            std::fill_n(stack[sp++].data(), n, props[op.arg]);
+            break;
+        case ExprOpcode::Add:
+            binary([](float a, float c) { return a + c; });
+            break;
+        case ExprOpcode::Sub:
+            binary([](float a, float c) { return a - c; });
+            break;
+        case ExprOpcode::Mul:
+            binary([](float a, float c) { return a * c; });
+            break;
+        case ExprOpcode::Div:
+            binary([](float a, float c) { return a / c; });
+            break;
+        case ExprOpcode::Max:
+            binary([](float a, float c) { return std::max(a, c); });
+            break;
+        case ExprOpcode::Min:
+            binary([](float a, float c) { return std::min(a, c); });
+            break;
+        case ExprOpcode::Pow:
+            binary([](float a, float c) { return std::pow(a, c); });
+            break;
+        case ExprOpcode::Greater:
+            binary([&](float a, float c) { return flag(a > c); });
+            break;
+        case ExprOpcode::Less:
+            binary([&](float a, float c) { return flag(a < c); });
+            break;
+        case ExprOpcode::Equal:
+            binary([&](float a, float c) { return flag(a == c); });
+            break;
+        case ExprOpcode::GreaterEqual:
+            binary([&](float a, float c) { return flag(a >= c); });
+            break;
+        case ExprOpcode::LessEqual:
+            binary([&](float a, float c) { return flag(a <= c); });
+            break;
+        case ExprOpcode::And:
+            binary([&](float a, float c) {
+                return flag(truth(a) && truth(c));
+            });
+            break;
+        case ExprOpcode::Or:
+            binary([&](float a, float c) {
+                return flag(truth(a) || truth(c));
+            });
+            break;
+        case ExprOpcode::Xor:
+            binary([&](float a, float c) {
+                return flag(truth(a) != truth(c));
+            });
+            break;
+        case ExprOpcode::Abs:
+            unary([](float a) { return std::abs(a); });
+            break;
+        case ExprOpcode::Sqrt:
+            unary([](float a) { return std::sqrt(std::max(a, 0.0F)); });
+            break;
+        case ExprOpcode::Exp:
+            unary([](float a) { return std::exp(a); });
+            break;
+        case ExprOpcode::Log:
+            unary([](float a) { return std::log(a); });
+            break;
+        case ExprOpcode::Not:
+            unary([&](float a) { return flag(!truth(a)); });
+            break;
+        case ExprOpcode::Ternary: {
+            float* VS_RESTRICT cond = stack[sp - 3].data();
+            const float* VS_RESTRICT if_true = stack[sp - 2].data();
+            const float* VS_RESTRICT if_false = stack[sp - 1].data();
+            for (int i = 0; i < n; ++i) {
+                cond[i] = truth(cond[i]) ? if_true[i] : if_false[i];
             }
+            sp -= 2;
+            break;
+        }
+        case ExprOpcode::Dup:
+            std::copy_n(stack[sp - 1 - op.arg].data(), n, stack[sp].data());
+            ++sp;
+            break;
+        case ExprOpcode::Swap:
+            std::swap_ranges(stack[sp - 1].data(), stack[sp - 1].data() + n,
+                             stack[sp - 1 - op.arg].data());
+            break;
         }
     }
+
+    std::copy_n(stack[0].data(), n, result);
 }
 
-struct ATWTData {
+struct ExprBandsData {
     VSNode* node;
     VSVideoInfo vi;
-    int radius;
-};
-
-struct ReplaceData {
-    VSNode* base;
-    VSNode* detail;
-    VSVideoInfo vi;
+    int levels;
+    std::vector<ExprProgram> programs;
 };
 
 template <typename T>
-void process_extract_plane(const VSFrame* src, VSFrame* dst, int plane,
-                           int radius, const VSVideoFormat* fi,
-                           const VSAPI* vsapi) {
+void expr_bands_plane(const VSFrame* src, VSFrame* dst, int plane,
+                      const ExprBandsData* d,
+                      const std::vector<std::vector<float>>& props,
+                      const VSAPI* vsapi) {
     const int width = vsapi->getFrameWidth(src, plane);
     const int height = vsapi->getFrameHeight(src, plane);
     const ptrdiff_t src_stride = vsapi->getStride(src, plane) / sizeof(T);
     const ptrdiff_t dst_stride = vsapi->getStride(dst, plane) / sizeof(T);
+    const VSVideoFormat* fi = &d->vi.format;
 
     const T* VS_RESTRICT srcp =
         reinterpret_cast<const T*>(vsapi->getReadPtr(src, plane));
     T* VS_RESTRICT dstp = reinterpret_cast<T*>(vsapi->getWritePtr(dst, plane));
 
-    int step = 1 << (radius - 1);
+    int depth = 1;
+    for (const ExprProgram& program : d->programs) {
+        depth = std::max(depth, program.depth);
+    }
+    ExprStack stack(depth);
+    std::array<float, EXPR_BLOCK> detail{};
+    std::array<float, EXPR_BLOCK> result{};
+    const float max_val = get_max<T>(fi);
+
+    auto load = [&](int y, int x_begin, int x_end, float* VS_RESTRICT base) {
+        const T* VS_RESTRICT src_row = srcp + (y * src_stride);
+        for (int x = x_begin; x < x_end; ++x) {
+            base[x - x_begin] = static_cast<float>(src_row[x]);
+        }
+    };
+
+    // Same cascade as Decompose; the detail is peeled off the base first so
+    // that b is the base of the level.
+    auto band = [&](int level, [[maybe_unused]] int y, int x_begin, int x_end,
+                    const float* VS_RESTRICT base,
+                    const float* VS_RESTRICT blur, float* VS_RESTRICT next,
+                    float* VS_RESTRICT sum) {
+        const ExprProgram& program = d->programs[level];
+        for (int i = 0; i < x_end - x_begin; i += EXPR_BLOCK) {
+            const int n = std::min(EXPR_BLOCK, x_end - x_begin - i);
+            float* VS_RESTRICT l = detail.data();
+            float* VS_RESTRICT b = next + i;
+            float* VS_RESTRICT s = sum + i;
+            for (int x = 0; x < n; ++x) {
+                l[x] = base[i + x] - blur[i + x];
+                b[x] = base[i + x] - l[x];
+            }
+            if (program.ops.empty()) {
+                for (int x = 0; x < n; ++x) {
+                    s[x] += l[x];
+                }
+            } else {
+                run_expr(program, l, b, props[level], result.data(), n,
+                         stack);
+                for (int x = 0; x < n; ++x) {
+                    s[x] += result[x];
+                }
+            }
+        }
+    };
 
-    std::vector<float> temp_buffer(static_cast<size_t>(width) * height);
-    float* VS_RESTRICT temp = temp_buffer.data();
+    auto store = [&](int y, int x_begin, int x_end,
+                     const float* VS_RESTRICT base,
+                     const float* VS_RESTRICT sum) {
+        T* VS_RESTRICT dst_row = dstp + (y * dst_stride) + x_begin;
+        for (int x = 0; x < x_end - x_begin; ++x) {
+            const float val = base[x] + sum[x];
+            if constexpr (std::integral<T>) {
+                dst_row[x] =
+                    static_cast<T>(std::clamp(std::round(val), 0.0F, max_val));
+            } else {
+                dst_row[x] = val;
+            }
+        }
+    };
 
-    conv_h<T>(srcp, temp, width, height, src_stride, step);
-    conv_v_and_extract<T>(temp, srcp, dstp, width, height, src_stride,
-                          dst_stride, step, fi);
+    CascadeScratch scratch;
+    const int tile = cascade_tile_width(width, d->levels, 1);
+    for (int left = 0; left < width; left += tile) {
+        cascade_tile(width, height, d->levels, left,
+                     std::min(left + tile, width), scratch, load, band, store);
+    }
 }
 
-const VSFrame* VS_CC ExtractGetFrame(int n, int activationReason,
-                                     void* instanceData,
-                                     [[maybe_unused]] void** frameData,
-                                     VSFrameContext* frameCtx, VSCore* core,
-                                     const VSAPI* vsapi) {
-    auto* d = static_cast<ATWTData*>(instanceData);
+const VSFrame* VS_CC ExprBandsGetFrame(int n, int activationReason,
+                                       void* instanceData,
+                                       [[maybe_unused]] void** frameData,
+                                       VSFrameContext* frameCtx, VSCore* core,
+                                       const VSAPI* vsapi) {
+    auto* d = static_cast<ExprBandsData*>(instanceData);
 
     if (activationReason == arInitial) {
         vsapi->requestFrameFilter(n, d->node, frameCtx);
     } else if (activationReason == arAllFramesReady) {
         const VSFrame* src = vsapi->getFrameFilter(n, d->node, frameCtx);
         const VSVideoFormat* fi = vsapi->getVideoFrameFormat(src);
+        VSFrame* dst = vsapi->newVideoFrame(fi, vsapi->getFrameWidth(src, 0),
+                                            vsapi->getFrameHeight(src, 0),
+                                            src, core);
 
-        VSFrame* dst =
-            vsapi->newVideoFrame(fi, vsapi->getFrameWidth(src, 0),
-                                 vsapi->getFrameHeight(src, 0), src, core);
+        // Missing properties read as 0.
+        std::vector<std::vector<float>> props;
+        for (const ExprProgram& program : d->programs) {
+            std::vector<float>& values = props.emplace_back();
+            for (const std::string& name : program.props) {
+                values.push_back(frame_param(src, name, 0.0F, vsapi));
+            }
+        }
 
         for (int plane = 0; plane < fi->numPlanes; plane++) {
             if (fi->sampleType == stInteger) {
                 switch (fi->bytesPerSample) {
                 case 1:
-                    process_extract_plane<uint8_t>(src, dst, plane, d->radius,
-                                                   fi, vsapi);
+                    expr_bands_plane<uint8_t>(src, dst, plane, d, props, vsapi);
                     break;
                 case 2:
-                    process_extract_plane<uint16_t>(src, dst, plane, d->radius,
-                                                    fi, vsapi);
-                    break;
-                case 4:
-                    process_extract_plane<uint32_t>(src, dst, plane, d->radius,
-                                                    fi, vsapi);
+                    expr_bands_plane<uint16_t>(src, dst, plane, d, props,
+                                               vsapi);
                     break;
                 }
             } else if (fi->sampleType == stFloat) {
                 switch (fi->bytesPerSample) {
                 case 4:
-                    process_extract_plane<float>(src, dst, plane, d->radius, fi,
-                                                 vsapi);
+                    expr_bands_plane<float>(src, dst, plane, d, props, vsapi);
                     break;
                 }
             }
@@ -184,192 +4093,531 @@ const VSFrame* VS_CC ExtractGetFrame(int n, int activationReason,
     return nullptr;
 }
 
-void VS_CC ExtractFree(void* instanceData, [[maybe_unused]] VSCore* core,
-                       const VSAPI* vsapi) {
-    auto d = std::unique_ptr<ATWTData>(static_cast<ATWTData*>(instanceData));
+void VS_CC ExprBandsFree(void* instanceData, [[maybe_unused]] VSCore* core,
+                         const VSAPI* vsapi) {
+    auto d = std::unique_ptr<ExprBandsData>(
+        static_cast<ExprBandsData*>(instanceData));
     vsapi->freeNode(d->node);
 }
 
-void VS_CC ExtractCreate(const VSMap* in, VSMap* out,
-                         [[maybe_unused]] void* userData, VSCore* core,
-                         const VSAPI* vsapi) {
-    auto d = std::make_unique<ATWTData>();
+void VS_CC ExprBandsCreate(const VSMap* in, VSMap* out,
+                           [[maybe_unused]] void* userData, VSCore* core,
+                           const VSAPI* vsapi) {
+    auto d = std::make_unique<ExprBandsData>();
     int err = 0;
 
     d->node = vsapi->mapGetNode(in, "clip", 0, 0);
     d->vi = *vsapi->getVideoInfo(d->node);
 
-    d->radius = vsh::int64ToIntS(vsapi->mapGetInt(in, "radius", 0, &err));
+    const int num_exprs = vsapi->mapNumElements(in, "exprs");
+    d->levels = vsh::int64ToIntS(vsapi->mapGetInt(in, "levels", 0, &err));
     if (err != 0) {
-        d->radius = 1;
+        d->levels = num_exprs;
     }
 
-    if (d->radius < 1) {
-        vsapi->mapSetError(out, "ExtractFrequency: radius must be >= 1");
+    if (d->levels < 1 || num_exprs < 1 || num_exprs > d->levels) {
+        vsapi->mapSetError(out, "ExprBands: levels must be >= 1 and exprs "
+                                "must have between 1 and levels values");
         vsapi->freeNode(d->node);
         return;
     }
 
-    if (!vsh::isConstantVideoFormat(&d->vi)) {
-        vsapi->mapSetError(
-            out,
-            "ExtractFrequency: only clips with constant format are accepted");
+    if (!vsh::isConstantVideoFormat(&d->vi) ||
+        !is_supported_format(d->vi.format)) {
+        vsapi->mapSetError(out, "ExprBands: only constant 8-16 bit integer or "
+                                "32 bit float input are accepted");
         vsapi->freeNode(d->node);
         return;
     }
 
-    if (((d->vi.format.bitsPerSample < 8 || d->vi.format.bitsPerSample > 16 ||
-          d->vi.format.sampleType != stInteger) &&
-         (d->vi.format.bitsPerSample != 32 ||
-          d->vi.format.sampleType != stFloat))) {
-        vsapi->mapSetError(out, "ExtractFrequency: only 8-16 bit "
-                                "integer or 32 bit float input "
-                                "are accepted");
+    if (!levels_fit(d->vi, d->levels)) {
+        vsapi->mapSetError(out, "ExprBands: 2^levels must be smaller than the "
+                                "width and height of every plane");
         vsapi->freeNode(d->node);
         return;
     }
 
+    // Levels past the end of exprs repeat its last expression.
+    d->programs.resize(d->levels);
+    for (int level = 0; level < d->levels; ++level) {
+        const std::string expr = vsapi->mapGetData(
+            in, "exprs", std::min(level, num_exprs - 1), nullptr);
+        const std::string error =
+            compile_expr(expr, level + 1, d->programs[level]);
+        if (!error.empty()) {
+            vsapi->mapSetError(out, ("ExprBands: level " +
+                                     std::to_string(level + 1) + ": " + error)
+                                        .c_str());
+            vsapi->freeNode(d->node);
+            return;
+        }
+    }
+
     VSFilterDependency deps[] = {{d->node, rpStrictSpatial}};
     auto* data = d.release();
-    vsapi->createVideoFilter(out, "ExtractFrequency", &data->vi,
-                             ExtractGetFrame, ExtractFree, fmParallel,
-                             std::data(deps), 1, data, core);
+    vsapi->createVideoFilter(out, "ExprBands", &data->vi, ExprBandsGetFrame,
+                             ExprBandsFree, fmParallel, std::data(deps), 1,
+                             data, core);
+}
+
+// Grain-aware denoising: each level's detail is thresholded at threshold
+// times the noise sigma of that level, looked up per pixel by the base of
+// the level, since grain depends on brightness. The noise profile gives
+// sigma per level at brightness points from black to peak, as a fraction of
+// the sample range; without one it is estimated from sample frames as the
+// median absolute detail of each brightness bin.
+constexpr int DENOISE_LUT = 256;
+// Brightness points of an estimated profile. The |detail| histograms of the
+// estimate have DENOISE_HIST bins up to DENOISE_HIST_RANGE of the sample
+// range, and bins with fewer than DENOISE_MIN_SAMPLES samples are
+// interpolated from their neighbours.
+constexpr int DENOISE_POINTS = 16;
+constexpr int DENOISE_HIST = 4096;
+constexpr float DENOISE_HIST_RANGE = 0.0625F;
+constexpr uint64_t DENOISE_MIN_SAMPLES = 256;
+// Median of the absolute value of unit Gaussian noise.
+constexpr float MAD_TO_SIGMA = 1.0F / 0.6745F;
+
+struct DenoiseData {
+    VSNode* node;
+    VSVideoInfo vi;
+    int levels;
+    float threshold;
+    bool soft;
+    // Sigma in sample units, DENOISE_LUT entries per level, for luma (or
+    // every plane of Gray and RGB) and for YUV chroma.
+    std::array<std::vector<float>, 2> lut;
+    std::string prop_threshold;
+};
+
+int noise_group(const VSVideoFormat& fi, int plane) noexcept {
+    return fi.colorFamily == cfYUV && plane > 0 ? 1 : 0;
+}
+
+float sample_range(const VSVideoFormat& fi) noexcept {
+    return fi.sampleType == stFloat ? get_max<float>(&fi)
+                                    : get_max<uint16_t>(&fi);
+}
+
+// Maps a base value of a plane linearly to [0, bins - 1], from black (the
+// lowest chroma value for float YUV chroma) to peak.
+struct BrightnessScale {
+    float low;
+    float scale;
+};
+
+BrightnessScale brightness_scale(const VSVideoFormat& fi, int plane,
+                                 int bins) noexcept {
+    const bool float_chroma =
+        fi.sampleType == stFloat && noise_group(fi, plane) == 1;
+    return {float_chroma ? -0.5F : 0.0F,
+            static_cast<float>(bins - 1) / sample_range(fi)};
+}
+
+// Interpolates the points of every level, given as fractions of the range,
+// into a table in sample units.
+std::vector<float> noise_lut(const std::vector<float>& profile, int levels,
+                             float range) {
+    const auto points = static_cast<int>(profile.size()) / levels;
+    std::vector<float> lut(static_cast<std::size_t>(levels) * DENOISE_LUT);
+    for (int level = 0; level < levels; ++level) {
+        const float* p = profile.data() + (level * points);
+        for (int i = 0; i < DENOISE_LUT; ++i) {
+            const float pos = static_cast<float>(i * (points - 1)) /
+                              static_cast<float>(DENOISE_LUT - 1);
+            const int j = std::min(static_cast<int>(pos), points - 1);
+            const int k = std::min(j + 1, points - 1);
+            const float t = pos - static_cast<float>(j);
+            lut[(level * DENOISE_LUT) + i] =
+                (p[j] + ((p[k] - p[j]) * t)) * range;
+        }
+    }
+    return lut;
 }
 
+// Adds the |detail| of every level of a plane to the histograms of its
+// brightness bin, DENOISE_POINTS * DENOISE_HIST counts per level.
 template <typename T>
-void ProcessReplacePlane(const VSFrame* base, const VSFrame* detail,
-                         VSFrame* dst, int plane, const VSVideoFormat* fi,
-                         const VSAPI* vsapi) {
-    const int width = vsapi->getFrameWidth(dst, plane);
-    const int height = vsapi->getFrameHeight(dst, plane);
-    const ptrdiff_t stride = vsapi->getStride(dst, plane) / sizeof(T);
+void sample_noise_plane(const VSFrame* src, int plane, const DenoiseData* d,
+                        std::vector<uint64_t>& hist, const VSAPI* vsapi) {
+    const int width = vsapi->getFrameWidth(src, plane);
+    const int height = vsapi->getFrameHeight(src, plane);
+    const ptrdiff_t src_stride = vsapi->getStride(src, plane) / sizeof(T);
+    const T* srcp = reinterpret_cast<const T*>(vsapi->getReadPtr(src, plane));
+
+    const BrightnessScale bs =
+        brightness_scale(d->vi.format, plane, DENOISE_POINTS);
+    const float hist_scale =
+        static_cast<float>(DENOISE_HIST) /
+        (DENOISE_HIST_RANGE * sample_range(d->vi.format));
+
+    auto load = [&](int y, int x_begin, int x_end, float* VS_RESTRICT base) {
+        const T* VS_RESTRICT src_row = srcp + (y * src_stride);
+        for (int x = x_begin; x < x_end; ++x) {
+            base[x - x_begin] = static_cast<float>(src_row[x]);
+        }
+    };
+
+    // Tiles only bin their own columns, so the halo is not counted twice.
+    int left = 0;
+    int right = 0;
+    auto band = [&](int level, [[maybe_unused]] int y, int x_begin, int x_end,
+                    const float* VS_RESTRICT base,
+                    const float* VS_RESTRICT blur, float* VS_RESTRICT next,
+                    [[maybe_unused]] float* acc) {
+        for (int x = 0; x < x_end - x_begin; ++x) {
+            next[x] = base[x] - (base[x] - blur[x]);
+        }
+        uint64_t* level_hist =
+            hist.data() + (static_cast<std::size_t>(level) * DENOISE_POINTS *
+                           DENOISE_HIST);
+        for (int x = left; x < right; ++x) {
+            const float l = base[x - x_begin] - blur[x - x_begin];
+            const auto bin = static_cast<int>(std::clamp(
+                ((next[x - x_begin] - bs.low) * bs.scale) + 0.5F, 0.0F,
+                static_cast<float>(DENOISE_POINTS - 1)));
+            const auto h = static_cast<int>(
+                std::min(std::abs(l) * hist_scale,
+                         static_cast<float>(DENOISE_HIST - 1)));
+            ++level_hist[(bin * DENOISE_HIST) + h];
+        }
+    };
+
+    CascadeScratch scratch;
+    const int tile = cascade_tile_width(width, d->levels, 1);
+    for (left = 0; left < width; left += tile) {
+        right = std::min(left + tile, width);
+        cascade_tile(
+            width, height, d->levels, left, right, scratch, load, band,
+            [](int, int, int, const float*, const float*) {});
+    }
+}
+
+// Noise profile of the histograms: per level and point, the median |detail|
+// scaled to a Gaussian sigma, as a fraction of the range.
+std::vector<float> noise_profile(const std::vector<uint64_t>& hist,
+                                 int levels) {
+    std::vector<float> profile(static_cast<std::size_t>(levels) *
+                               DENOISE_POINTS);
+    for (int level = 0; level < levels; ++level) {
+        float* p = profile.data() + (level * DENOISE_POINTS);
+        std::vector<int> known;
+        for (int bin = 0; bin < DENOISE_POINTS; ++bin) {
+            const uint64_t* h =
+                hist.data() +
+                (((static_cast<std::size_t>(level) * DENOISE_POINTS) + bin) *
+                 DENOISE_HIST);
+            const uint64_t total = std::accumulate(h, h + DENOISE_HIST,
+                                                   uint64_t{0});
+            if (total < DENOISE_MIN_SAMPLES) {
+                continue;
+            }
+            uint64_t count = 0;
+            int median = 0;
+            while ((count += h[median]) < (total + 1) / 2) {
+                ++median;
+            }
+            p[bin] = (static_cast<float>(median) + 0.5F) * DENOISE_HIST_RANGE /
+                     static_cast<float>(DENOISE_HIST) * MAD_TO_SIGMA;
+            known.push_back(bin);
+        }
+
+        // Bins without enough samples interpolate between the nearest known
+        // ones and repeat them past the ends.
+        for (int bin = 0; bin < DENOISE_POINTS && !known.empty(); ++bin) {
+            const auto upper = std::ranges::lower_bound(known, bin);
+            if (upper != known.end() && *upper == bin) {
+                continue;
+            }
+            if (upper == known.begin() || upper == known.end()) {
+                p[bin] = p[upper == known.end() ? known.back() : *upper];
+                continue;
+            }
+            const int lo = *(upper - 1);
+            const int hi = *upper;
+            p[bin] = p[lo] + ((p[hi] - p[lo]) * static_cast<float>(bin - lo) /
+                              static_cast<float>(hi - lo));
+        }
+    }
+    return profile;
+}
+
+template <typename T>
+void denoise_plane(const VSFrame* src, VSFrame* dst, int plane,
+                   const DenoiseData* d, float threshold,
+                   const VSAPI* vsapi) {
+    const int width = vsapi->getFrameWidth(src, plane);
+    const int height = vsapi->getFrameHeight(src, plane);
+    const ptrdiff_t src_stride = vsapi->getStride(src, plane) / sizeof(T);
+    const ptrdiff_t dst_stride = vsapi->getStride(dst, plane) / sizeof(T);
+    const VSVideoFormat* fi = &d->vi.format;
 
-    const T* basep = reinterpret_cast<const T*>(vsapi->getReadPtr(base, plane));
-    const T* detailp =
-        reinterpret_cast<const T*>(vsapi->getReadPtr(detail, plane));
+    const T* VS_RESTRICT srcp =
+        reinterpret_cast<const T*>(vsapi->getReadPtr(src, plane));
     T* VS_RESTRICT dstp = reinterpret_cast<T*>(vsapi->getWritePtr(dst, plane));
 
-    const float neutral = get_neutral<T>(fi);
+    const BrightnessScale bs = brightness_scale(*fi, plane, DENOISE_LUT);
+    const std::vector<float>& lut = d->lut[noise_group(*fi, plane)];
     const float max_val = get_max<T>(fi);
 
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            auto b = static_cast<float>(basep[x]);
-            auto d = static_cast<float>(detailp[x]);
+    auto load = [&](int y, int x_begin, int x_end, float* VS_RESTRICT base) {
+        const T* VS_RESTRICT src_row = srcp + (y * src_stride);
+        for (int x = x_begin; x < x_end; ++x) {
+            base[x - x_begin] = static_cast<float>(src_row[x]);
+        }
+    };
 
-            float val = b + d - neutral;
+    // The sigma is looked up by the base of the level, as b in ExprBands,
+    // which is the local brightness without the level's own noise.
+    auto band = [&](int level, [[maybe_unused]] int y, int x_begin, int x_end,
+                    const float* VS_RESTRICT base,
+                    const float* VS_RESTRICT blur, float* VS_RESTRICT next,
+                    float* VS_RESTRICT sum) {
+        const float* VS_RESTRICT sigma = lut.data() + (level * DENOISE_LUT);
+        for (int x = 0; x < x_end - x_begin; ++x) {
+            const float l = base[x] - blur[x];
+            next[x] = base[x] - l;
+            const auto i = static_cast<int>(
+                std::clamp(((next[x] - bs.low) * bs.scale) + 0.5F, 0.0F,
+                           static_cast<float>(DENOISE_LUT - 1)));
+            const float t = threshold * sigma[i];
+            if (d->soft) {
+                sum[x] += l - std::clamp(l, -t, t);
+            } else {
+                sum[x] += std::abs(l) > t ? l : 0.0F;
+            }
+        }
+    };
 
+    auto store = [&](int y, int x_begin, int x_end,
+                     const float* VS_RESTRICT base,
+                     const float* VS_RESTRICT sum) {
+        T* VS_RESTRICT dst_row = dstp + (y * dst_stride) + x_begin;
+        for (int x = 0; x < x_end - x_begin; ++x) {
+            const float val = base[x] + sum[x];
             if constexpr (std::integral<T>) {
-                dstp[x] =
+                dst_row[x] =
                     static_cast<T>(std::clamp(std::round(val), 0.0F, max_val));
             } else {
-                dstp[x] = static_cast<T>(val);
+                dst_row[x] = val;
             }
         }
-        basep += stride;
-        detailp += stride;
-        dstp += stride;
+    };
+
+    CascadeScratch scratch;
+    const int tile = cascade_tile_width(width, d->levels, 1);
+    for (int left = 0; left < width; left += tile) {
+        cascade_tile(width, height, d->levels, left,
+                     std::min(left + tile, width), scratch, load, band, store);
     }
 }
 
-const VSFrame* VS_CC ReplaceGetFrame(int n, int activationReason,
+const VSFrame* VS_CC DenoiseGetFrame(int n, int activationReason,
                                      void* instanceData,
                                      [[maybe_unused]] void** frameData,
                                      VSFrameContext* frameCtx, VSCore* core,
                                      const VSAPI* vsapi) {
-    auto* d = static_cast<ReplaceData*>(instanceData);
+    auto* d = static_cast<DenoiseData*>(instanceData);
 
     if (activationReason == arInitial) {
-        vsapi->requestFrameFilter(n, d->base, frameCtx);
-        vsapi->requestFrameFilter(n, d->detail, frameCtx);
+        vsapi->requestFrameFilter(n, d->node, frameCtx);
     } else if (activationReason == arAllFramesReady) {
-        const VSFrame* base = vsapi->getFrameFilter(n, d->base, frameCtx);
-        const VSFrame* detail = vsapi->getFrameFilter(n, d->detail, frameCtx);
-        const VSVideoFormat* fi = vsapi->getVideoFrameFormat(base);
+        const VSFrame* src = vsapi->getFrameFilter(n, d->node, frameCtx);
+        const VSVideoFormat* fi = vsapi->getVideoFrameFormat(src);
 
-        VSFrame* dst =
-            vsapi->newVideoFrame(fi, vsapi->getFrameWidth(base, 0),
-                                 vsapi->getFrameHeight(base, 0), base, core);
+        const float threshold =
+            frame_param(src, d->prop_threshold, d->threshold, vsapi);
+        if (threshold < 0.0F) {
+            vsapi->setFilterError("Denoise: threshold must be >= 0",
+                                  frameCtx);
+            vsapi->freeFrame(src);
+            return nullptr;
+        }
+
+        VSFrame* dst = vsapi->newVideoFrame(fi, vsapi->getFrameWidth(src, 0),
+                                            vsapi->getFrameHeight(src, 0),
+                                            src, core);
 
         for (int plane = 0; plane < fi->numPlanes; plane++) {
             if (fi->sampleType == stInteger) {
                 switch (fi->bytesPerSample) {
                 case 1:
-                    ProcessReplacePlane<uint8_t>(base, detail, dst, plane, fi,
-                                                 vsapi);
+                    denoise_plane<uint8_t>(src, dst, plane, d, threshold,
+                                           vsapi);
                     break;
                 case 2:
-                    ProcessReplacePlane<uint16_t>(base, detail, dst, plane, fi,
-                                                  vsapi);
-                    break;
-                case 4:
-                    ProcessReplacePlane<uint32_t>(base, detail, dst, plane, fi,
-                                                  vsapi);
+                    denoise_plane<uint16_t>(src, dst, plane, d, threshold,
+                                            vsapi);
                     break;
                 }
             } else if (fi->sampleType == stFloat) {
                 switch (fi->bytesPerSample) {
                 case 4:
-                    ProcessReplacePlane<float>(base, detail, dst, plane, fi,
-                                               vsapi);
+                    denoise_plane<float>(src, dst, plane, d, threshold,
+                                         vsapi);
                     break;
                 }
             }
         }
 
-        vsapi->freeFrame(base);
-        vsapi->freeFrame(detail);
+        vsapi->freeFrame(src);
         return dst;
     }
     return nullptr;
 }
 
-void VS_CC ReplaceFree(void* instanceData, [[maybe_unused]] VSCore* core,
+void VS_CC DenoiseFree(void* instanceData, [[maybe_unused]] VSCore* core,
                        const VSAPI* vsapi) {
     auto d =
-        std::unique_ptr<ReplaceData>(static_cast<ReplaceData*>(instanceData));
-    vsapi->freeNode(d->base);
-    vsapi->freeNode(d->detail);
+        std::unique_ptr<DenoiseData>(static_cast<DenoiseData*>(instanceData));
+    vsapi->freeNode(d->node);
 }
 
-void VS_CC ReplaceCreate(const VSMap* in, VSMap* out,
-                         [[maybe_unused]] void* userData, VSCore* core,
-                         const VSAPI* vsapi) {
-    auto d = std::make_unique<ReplaceData>();
+// Estimates the profiles of the plane groups that have none from `samples`
+// frames spread evenly over the clip. Returns an error message on failure.
+std::string estimate_noise(DenoiseData* d, int samples,
+                           std::array<std::vector<float>, 2>& profiles,
+                           const VSAPI* vsapi) {
+    const VSVideoFormat& fi = d->vi.format;
+    std::array<std::vector<uint64_t>, 2> hist;
+    for (int group = 0; group < 2; ++group) {
+        if (profiles[group].empty()) {
+            hist[group].assign(static_cast<std::size_t>(d->levels) *
+                                   DENOISE_POINTS * DENOISE_HIST,
+                               0);
+        }
+    }
 
-    d->base = vsapi->mapGetNode(in, "base", 0, 0);
-    d->detail = vsapi->mapGetNode(in, "detail", 0, 0);
-    d->vi = *vsapi->getVideoInfo(d->base);
-    const VSVideoInfo* vi_detail = vsapi->getVideoInfo(d->detail);
+    samples = std::min(samples, d->vi.numFrames);
+    for (int i = 0; i < samples; ++i) {
+        const int n = static_cast<int>(static_cast<int64_t>(i) *
+                                       d->vi.numFrames / samples);
+        char frame_error[1024] = {};
+        const VSFrame* frame = vsapi->getFrame(
+            n, d->node, std::data(frame_error), sizeof(frame_error));
+        if (frame == nullptr) {
+            return std::data(frame_error);
+        }
 
-    if (!vsh::isSameVideoFormat(&d->vi.format, &vi_detail->format)) {
-        vsapi->mapSetError(out,
-                           "ReplaceFrequency: base and detail must have the "
-                           "same format and dimensions");
-        vsapi->freeNode(d->base);
-        vsapi->freeNode(d->detail);
+        for (int plane = 0; plane < fi.numPlanes; plane++) {
+            const int group = noise_group(fi, plane);
+            if (!profiles[group].empty()) {
+                continue;
+            }
+            std::vector<uint64_t>& h = hist[group];
+            if (fi.sampleType == stInteger && fi.bytesPerSample == 1) {
+                sample_noise_plane<uint8_t>(frame, plane, d, h, vsapi);
+            } else if (fi.sampleType == stInteger) {
+                sample_noise_plane<uint16_t>(frame, plane, d, h, vsapi);
+            } else {
+                sample_noise_plane<float>(frame, plane, d, h, vsapi);
+            }
+        }
+        vsapi->freeFrame(frame);
+    }
+
+    for (int group = 0; group < 2; ++group) {
+        if (profiles[group].empty()) {
+            profiles[group] = noise_profile(hist[group], d->levels);
+        }
+    }
+    return {};
+}
+
+void VS_CC DenoiseCreate(const VSMap* in, VSMap* out,
+                         [[maybe_unused]] void* userData,
+                         [[maybe_unused]] VSCore* core, const VSAPI* vsapi) {
+    auto d = std::make_unique<DenoiseData>();
+    int err = 0;
+
+    d->node = vsapi->mapGetNode(in, "clip", 0, 0);
+    d->vi = *vsapi->getVideoInfo(d->node);
+
+    d->levels = vsh::int64ToIntS(vsapi->mapGetInt(in, "levels", 0, &err));
+    if (err != 0) {
+        d->levels = 3;
+    }
+
+    d->threshold = vsapi->mapGetFloatSaturated(in, "threshold", 0, &err);
+    if (err != 0) {
+        d->threshold = 2.0F;
+    }
+
+    d->soft = vsapi->mapGetInt(in, "soft", 0, &err) != 0;
+    if (err != 0) {
+        d->soft = true;
+    }
+
+    int samples = vsh::int64ToIntS(vsapi->mapGetInt(in, "samples", 0, &err));
+    if (err != 0) {
+        samples = 8;
+    }
+
+    d->prop_threshold = read_prop_name(in, "prop_threshold", vsapi);
+
+    // chroma_profile defaults to profile.
+    std::array<std::vector<float>, 2> profiles;
+    const std::array<const char*, 2> keys = {"profile", "chroma_profile"};
+    for (int group = 0; group < 2; ++group) {
+        const int num = vsapi->mapNumElements(in, keys[group]);
+        for (int i = 0; i < num; ++i) {
+            profiles[group].push_back(
+                vsapi->mapGetFloatSaturated(in, keys[group], i, nullptr));
+        }
+    }
+    if (profiles[1].empty()) {
+        profiles[1] = profiles[0];
+    }
+
+    const bool profiles_ok =
+        std::ranges::all_of(profiles, [&](const std::vector<float>& p) {
+            return d->levels > 0 && p.size() % d->levels == 0 &&
+                   std::ranges::all_of(p, [](float v) { return v >= 0.0F; });
+        });
+    if (d->levels < 1 || d->threshold < 0.0F || samples < 1 || !profiles_ok) {
+        vsapi->mapSetError(out, "Denoise: levels and samples must be >= 1, "
+                                "threshold >= 0, and profile and "
+                                "chroma_profile must hold the same number of "
+                                "non-negative values for every level");
+        vsapi->freeNode(d->node);
         return;
     }
 
-    if (((d->vi.format.bitsPerSample < 8 || d->vi.format.bitsPerSample > 16 ||
-          d->vi.format.sampleType != stInteger) &&
-         (d->vi.format.bitsPerSample != 32 ||
-          d->vi.format.sampleType != stFloat)) ||
-        !vsh::isConstantVideoFormat(&d->vi)) {
-        vsapi->mapSetError(out, "ReplaceFrequency: only constant 8-16 bit "
-                                "integer or 32 bit float input "
-                                "are accepted");
-        vsapi->freeNode(d->base);
-        vsapi->freeNode(d->detail);
+    if (!vsh::isConstantVideoFormat(&d->vi) ||
+        !is_supported_format(d->vi.format)) {
+        vsapi->mapSetError(out, "Denoise: only constant 8-16 bit integer or "
+                                "32 bit float input are accepted");
+        vsapi->freeNode(d->node);
+        return;
+    }
+
+    if (!levels_fit(d->vi, d->levels)) {
+        vsapi->mapSetError(out, "Denoise: 2^levels must be smaller than the "
+                                "width and height of every plane");
+        vsapi->freeNode(d->node);
         return;
     }
 
-    VSFilterDependency deps[] = {{d->base, rpStrictSpatial},
-                                 {d->detail, rpStrictSpatial}};
+    if (profiles[0].empty() || profiles[1].empty()) {
+        const std::string error = estimate_noise(d.get(), samples, profiles,
+                                                 vsapi);
+        if (!error.empty()) {
+            vsapi->mapSetError(out, ("Denoise: " + error).c_str());
+            vsapi->freeNode(d->node);
+            return;
+        }
+    }
+
+    for (int group = 0; group < 2; ++group) {
+        d->lut[group] = noise_lut(profiles[group], d->levels,
+                                  sample_range(d->vi.format));
+    }
+
+    VSFilterDependency deps[] = {{d->node, rpStrictSpatial}};
     auto* data = d.release();
-    vsapi->createVideoFilter(out, "ReplaceFrequency", &data->vi,
-                             ReplaceGetFrame, ReplaceFree, fmParallel,
-                             std::data(deps), 2, data, core);
+    vsapi->createVideoFilter(out, "Denoise", &data->vi, DenoiseGetFrame,
+                             DenoiseFree, fmParallel, std::data(deps), 1, data,
+                             core);
 }
 
 } // namespace
@@ -379,8 +4627,61 @@ VapourSynthPluginInit2(VSPlugin* plugin, const VSPLUGINAPI* vspapi) {
     vspapi->configPlugin("com.yuygfgg.atwt", "atwt",
                          "À Trous Wavelet Transform", VS_MAKE_VERSION(1, 0),
                          VAPOURSYNTH_API_VERSION, 0, plugin);
-    vspapi->registerFunction("ExtractFrequency", "clip:vnode;radius:int:opt;",
+    vspapi->registerFunction("ExtractFrequency",
+                             "clip:vnode;radius:int[]:opt;"
+                             "radius_h:int[]:opt;radius_v:int[]:opt;"
+                             "threads:int:opt;"
+                             "normalize:int:opt;eps:float:opt;"
+                             "max_gain:float:opt;lossless:int:opt;"
+                             "prop_eps:data:opt;prop_max_gain:data:opt;"
+                             "left:int:opt;top:int:opt;width:int:opt;"
+                             "height:int:opt;",
                              "clip:vnode;", ExtractCreate, nullptr, plugin);
-    vspapi->registerFunction("ReplaceFrequency", "base:vnode;detail:vnode;",
+    vspapi->registerFunction("ExtractTemporal",
+                             "clip:vnode;radius:int:opt;vectors:vnode:opt;",
+                             "clip:vnode;", TemporalCreate, nullptr, plugin);
+    vspapi->registerFunction("ReplaceFrequency",
+                             "base:vnode;detail:vnode;mask:vnode:opt;"
+                             "first_plane:int:opt;left:int:opt;top:int:opt;"
+                             "width:int:opt;height:int:opt;"
+                             "overshoot:float:opt;overshoot_radius:int:opt;"
+                             "reference:vnode:opt;gain:float:opt;"
+                             "prop_gain:data:opt;prop_overshoot:data:opt;",
                              "clip:vnode;", ReplaceCreate, nullptr, plugin);
+    vspapi->registerFunction("Decompose",
+                             "clip:vnode;levels:int[]:opt;lossless:int:opt;"
+                             "threads:int:opt;packed:int:opt;"
+                             "temporal_radius:int:opt;"
+                             "temporal_median:int:opt;"
+                             "temporal_levels:int[]:opt;normalize:int:opt;"
+                             "eps:float:opt;max_gain:float:opt;"
+                             "prop_eps:data:opt;prop_max_gain:data:opt;",
+                             "clip:vnode[];", DecomposeCreate, nullptr, plugin);
+    vspapi->registerFunction("Recompose",
+                             "clips:vnode[];weights:vnode[]:opt;"
+                             "mask:vnode:opt;first_plane:int:opt;"
+                             "overshoot:float:opt;overshoot_radius:int:opt;"
+                             "reference:vnode:opt;temporal_radius:int:opt;"
+                             "temporal_median:int:opt;"
+                             "temporal_levels:int[]:opt;gain:float:opt;"
+                             "prop_gain:data:opt;prop_overshoot:data:opt;"
+                             "levels:int:opt;",
+                             "clip:vnode;", RecomposeCreate, nullptr, plugin);
+    vspapi->registerFunction("Unpack", "clip:vnode;levels:int;",
+                             "clip:vnode[];", UnpackCreate, nullptr, plugin);
+    vspapi->registerFunction("ExprBands",
+                             "clip:vnode;exprs:data[];levels:int:opt;",
+                             "clip:vnode;", ExprBandsCreate, nullptr, plugin);
+    vspapi->registerFunction("ToneCompress",
+                             "clip:vnode;levels:int:opt;"
+                             "compression:float:opt;detail_gain:float[]:opt;"
+                             "prop_compression:data:opt;"
+                             "prop_detail_gain:data:opt;",
+                             "clip:vnode;", ToneCreate, nullptr, plugin);
+    vspapi->registerFunction("Denoise",
+                             "clip:vnode;levels:int:opt;profile:float[]:opt;"
+                             "chroma_profile:float[]:opt;"
+                             "threshold:float:opt;soft:int:opt;"
+                             "samples:int:opt;prop_threshold:data:opt;",
+                             "clip:vnode;", DenoiseCreate, nullptr, plugin);
 }